@@ -0,0 +1,347 @@
+/*
+ Author: Alexander Knauer <a-x-e@gmx.net>
+ License: Apache 2.0
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#define KLAFS_ALLOC_NO_WRAP
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <digitalSTROM/dsuid.h>
+#include <dsvdc/dsvdc.h>
+
+#include "klafs.h"
+
+/* allocation accounting, built with ./configure --enable-alloc-stats: klafs.h
+ * redirects malloc, calloc, realloc, strdup and free of the vDC sources to the
+ * wrappers below. Every allocation is counted for its call site (file:line,
+ * the file being the subsystem) and kept in a pointer table, so a free is
+ * credited to the site which allocated the block, also when another subsystem
+ * frees it. Blocks allocated by libraries (e.g. property names returned by
+ * libdsvdc) are not in the table and only counted as untracked frees.
+ */
+
+#ifdef KLAFS_ALLOC_STATS
+
+#define ALLOC_MAX_SITES 256
+#define ALLOC_BUCKETS 4096
+
+typedef struct alloc_site {
+  const char *file;
+  int line;
+  unsigned long allocs;
+  unsigned long frees;
+  unsigned long live_blocks;
+  size_t live_bytes;
+  size_t peak_bytes;
+  unsigned long allocs_snapshot;
+  unsigned long allocs_per_min;
+} alloc_site_t;
+
+typedef struct alloc_block {
+  struct alloc_block *next;
+  void *ptr;
+  size_t size;
+  alloc_site_t *site;
+} alloc_block_t;
+
+static alloc_site_t g_alloc_sites[ALLOC_MAX_SITES];
+static unsigned int g_alloc_site_count = 0;
+static alloc_block_t *g_alloc_blocks[ALLOC_BUCKETS];
+static size_t g_alloc_live_bytes = 0;
+static size_t g_alloc_peak_bytes = 0;
+static unsigned long g_alloc_untracked_frees = 0;
+static unsigned long g_alloc_dropped = 0;
+static time_t g_alloc_snapshot_time = 0;
+static pthread_mutex_t g_alloc_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static unsigned int alloc_bucket(const void *ptr) {
+  uintptr_t p = (uintptr_t) ptr;
+  return (unsigned int) ((p >> 4) ^ (p >> 16)) % ALLOC_BUCKETS;
+}
+
+/* open addressing on file and line; NULL if the site table is full */
+static alloc_site_t* alloc_find_site_locked(const char *file, int line) {
+  unsigned int start = (unsigned int) (((uintptr_t) file >> 3) + line * 31) % ALLOC_MAX_SITES;
+  for (unsigned int i = 0; i < ALLOC_MAX_SITES; i++) {
+    alloc_site_t *site = &g_alloc_sites[(start + i) % ALLOC_MAX_SITES];
+    if (site->file == NULL) {
+      site->file = file;
+      site->line = line;
+      g_alloc_site_count++;
+      return site;
+    }
+    if (site->file == file && site->line == line) {
+      return site;
+    }
+  }
+  return NULL;
+}
+
+static void alloc_insert_locked(alloc_block_t *block) {
+  unsigned int bucket = alloc_bucket(block->ptr);
+  block->next = g_alloc_blocks[bucket];
+  g_alloc_blocks[bucket] = block;
+
+  alloc_site_t *site = block->site;
+  site->live_blocks++;
+  site->live_bytes += block->size;
+  if (site->live_bytes > site->peak_bytes) {
+    site->peak_bytes = site->live_bytes;
+  }
+  g_alloc_live_bytes += block->size;
+  if (g_alloc_live_bytes > g_alloc_peak_bytes) {
+    g_alloc_peak_bytes = g_alloc_live_bytes;
+  }
+}
+
+static void alloc_track(void *ptr, size_t size, const char *file, int line) {
+  alloc_block_t *block = malloc(sizeof(alloc_block_t));
+
+  pthread_mutex_lock(&g_alloc_mutex);
+  alloc_site_t *site = alloc_find_site_locked(file, line);
+  if (block == NULL || site == NULL) {
+    g_alloc_dropped++;
+    pthread_mutex_unlock(&g_alloc_mutex);
+    free(block);
+    return;
+  }
+  block->ptr = ptr;
+  block->size = size;
+  block->site = site;
+  site->allocs++;
+  alloc_insert_locked(block);
+  pthread_mutex_unlock(&g_alloc_mutex);
+}
+
+/* removes the block of ptr from the table, NULL if it was not allocated by a wrapper */
+static alloc_block_t* alloc_remove(void *ptr) {
+  alloc_block_t **link;
+  alloc_block_t *block = NULL;
+
+  pthread_mutex_lock(&g_alloc_mutex);
+  for (link = &g_alloc_blocks[alloc_bucket(ptr)]; *link != NULL; link = &(*link)->next) {
+    if ((*link)->ptr == ptr) {
+      block = *link;
+      *link = block->next;
+      break;
+    }
+  }
+  if (block == NULL) {
+    g_alloc_untracked_frees++;
+  } else {
+    block->site->frees++;
+    block->site->live_blocks--;
+    block->site->live_bytes -= block->size;
+    g_alloc_live_bytes -= block->size;
+  }
+  pthread_mutex_unlock(&g_alloc_mutex);
+  return block;
+}
+
+void* alloc_malloc(size_t size, const char *file, int line) {
+  void *ptr = malloc(size);
+  if (ptr != NULL) {
+    alloc_track(ptr, size, file, line);
+  }
+  return ptr;
+}
+
+void* alloc_calloc(size_t nmemb, size_t size, const char *file, int line) {
+  void *ptr = calloc(nmemb, size);
+  if (ptr != NULL) {
+    alloc_track(ptr, nmemb * size, file, line);
+  }
+  return ptr;
+}
+
+/* a resized block is counted as a new allocation of the calling site */
+void* alloc_realloc(void *ptr, size_t size, const char *file, int line) {
+  alloc_block_t *block = ptr != NULL ? alloc_remove(ptr) : NULL;
+
+  void *moved = realloc(ptr, size);
+  if (moved == NULL && size > 0) {
+    /* the old block is still allocated */
+    if (block != NULL) {
+      pthread_mutex_lock(&g_alloc_mutex);
+      block->site->frees--;
+      alloc_insert_locked(block);
+      pthread_mutex_unlock(&g_alloc_mutex);
+    }
+    return NULL;
+  }
+  free(block);
+  if (moved != NULL) {
+    alloc_track(moved, size, file, line);
+  }
+  return moved;
+}
+
+char* alloc_strdup(const char *s, const char *file, int line) {
+  char *copy = strdup(s);
+  if (copy != NULL) {
+    alloc_track(copy, strlen(copy) + 1, file, line);
+  }
+  return copy;
+}
+
+void alloc_free(void *ptr) {
+  if (ptr == NULL) {
+    return;
+  }
+  free(alloc_remove(ptr));
+  free(ptr);
+}
+
+/* subsystem name of a site: the source file without directory and extension */
+static void alloc_subsystem(const char *file, char *name, size_t size) {
+  const char *base = strrchr(file, '/') ? strrchr(file, '/') + 1 : file;
+  snprintf(name, size, "%s", base);
+  char *dot = strrchr(name, '.');
+  if (dot != NULL) {
+    *dot = '\0';
+  }
+}
+
+/* x-klafs-statistics: totals, live memory per subsystem and the sites holding most memory */
+#define ALLOC_TOP_SITES 16
+
+void alloc_add_property(dsvdc_property_t *property) {
+  dsvdc_property_t *reply;
+  dsvdc_property_t *subsystems;
+  dsvdc_property_t *sites;
+  alloc_site_t *top[ALLOC_TOP_SITES];
+  int top_count = 0;
+
+  if (dsvdc_property_new(&reply) != DSVDC_OK) {
+    return;
+  }
+  if (dsvdc_property_new(&subsystems) != DSVDC_OK) {
+    dsvdc_property_free(reply);
+    return;
+  }
+  if (dsvdc_property_new(&sites) != DSVDC_OK) {
+    dsvdc_property_free(subsystems);
+    dsvdc_property_free(reply);
+    return;
+  }
+
+  pthread_mutex_lock(&g_alloc_mutex);
+
+  dsvdc_property_add_uint(reply, "liveBytes", g_alloc_live_bytes);
+  dsvdc_property_add_uint(reply, "peakBytes", g_alloc_peak_bytes);
+  dsvdc_property_add_uint(reply, "sites", g_alloc_site_count);
+  dsvdc_property_add_uint(reply, "untrackedFrees", g_alloc_untracked_frees);
+  dsvdc_property_add_uint(reply, "dropped", g_alloc_dropped);
+
+  /* sum the sites of each file; the first site of a file reports them all */
+  for (int i = 0; i < ALLOC_MAX_SITES; i++) {
+    alloc_site_t *site = &g_alloc_sites[i];
+    if (site->file == NULL) {
+      continue;
+    }
+    bool first = true;
+    for (int j = 0; j < i; j++) {
+      if (g_alloc_sites[j].file != NULL && strcmp(g_alloc_sites[j].file, site->file) == 0) {
+        first = false;
+        break;
+      }
+    }
+    if (first) {
+      unsigned long allocs = 0, frees = 0, live_blocks = 0;
+      size_t live_bytes = 0;
+      for (int j = i; j < ALLOC_MAX_SITES; j++) {
+        alloc_site_t *other = &g_alloc_sites[j];
+        if (other->file != NULL && strcmp(other->file, site->file) == 0) {
+          allocs += other->allocs;
+          frees += other->frees;
+          live_blocks += other->live_blocks;
+          live_bytes += other->live_bytes;
+        }
+      }
+      dsvdc_property_t *prop;
+      if (dsvdc_property_new(&prop) == DSVDC_OK) {
+        char subsystem[32];
+        alloc_subsystem(site->file, subsystem, sizeof(subsystem));
+        dsvdc_property_add_uint(prop, "allocs", allocs);
+        dsvdc_property_add_uint(prop, "frees", frees);
+        dsvdc_property_add_uint(prop, "liveBlocks", live_blocks);
+        dsvdc_property_add_uint(prop, "liveBytes", live_bytes);
+        dsvdc_property_add_property(subsystems, subsystem, &prop);
+      }
+    }
+
+    /* insertion into the top list by live bytes */
+    int pos = top_count < ALLOC_TOP_SITES ? top_count : ALLOC_TOP_SITES - 1;
+    if (top_count == ALLOC_TOP_SITES && top[pos]->live_bytes >= site->live_bytes) {
+      continue;
+    }
+    while (pos > 0 && top[pos - 1]->live_bytes < site->live_bytes) {
+      top[pos] = top[pos - 1];
+      pos--;
+    }
+    top[pos] = site;
+    if (top_count < ALLOC_TOP_SITES) {
+      top_count++;
+    }
+  }
+
+  for (int i = 0; i < top_count; i++) {
+    dsvdc_property_t *prop;
+    if (dsvdc_property_new(&prop) != DSVDC_OK) {
+      break;
+    }
+    char key[64];
+    const char *base = strrchr(top[i]->file, '/') ? strrchr(top[i]->file, '/') + 1 : top[i]->file;
+    snprintf(key, sizeof(key), "%s:%d", base, top[i]->line);
+    dsvdc_property_add_uint(prop, "allocs", top[i]->allocs);
+    dsvdc_property_add_uint(prop, "allocsPerMin", top[i]->allocs_per_min);
+    dsvdc_property_add_uint(prop, "liveBlocks", top[i]->live_blocks);
+    dsvdc_property_add_uint(prop, "liveBytes", top[i]->live_bytes);
+    dsvdc_property_add_uint(prop, "peakBytes", top[i]->peak_bytes);
+    dsvdc_property_add_property(sites, key, &prop);
+  }
+
+  pthread_mutex_unlock(&g_alloc_mutex);
+
+  dsvdc_property_add_property(reply, "subsystems", &subsystems);
+  dsvdc_property_add_property(reply, "topSites", &sites);
+  dsvdc_property_add_property(property, "allocations", &reply);
+}
+
+/* called with the statistics snapshot: updates the allocation rates and logs
+ * the sites which allocated or still hold memory since the last snapshot
+ */
+void alloc_snapshot() {
+  time_t now = time(NULL);
+
+  pthread_mutex_lock(&g_alloc_mutex);
+  time_t interval = g_alloc_snapshot_time != 0 ? now - g_alloc_snapshot_time : 0;
+  vdc_report(LOG_INFO, "allocations: %zu bytes live, peak %zu bytes, %u sites, %lu untracked frees\n",
+      g_alloc_live_bytes, g_alloc_peak_bytes, g_alloc_site_count, g_alloc_untracked_frees);
+  for (int i = 0; i < ALLOC_MAX_SITES; i++) {
+    alloc_site_t *site = &g_alloc_sites[i];
+    if (site->file == NULL) {
+      continue;
+    }
+    unsigned long allocs = site->allocs - site->allocs_snapshot;
+    site->allocs_per_min = interval > 0 ? allocs * 60 / interval : 0;
+    site->allocs_snapshot = site->allocs;
+    if (allocs > 0 || site->live_blocks > 0) {
+      vdc_report(LOG_INFO, "allocations: %s:%d +%lu allocs (%lu/min), %lu blocks / %zu bytes live\n",
+          site->file, site->line, allocs, site->allocs_per_min, site->live_blocks, site->live_bytes);
+    }
+  }
+  g_alloc_snapshot_time = now;
+  pthread_mutex_unlock(&g_alloc_mutex);
+}
+
+#endif /* KLAFS_ALLOC_STATS */
@@ -0,0 +1,152 @@
+/*
+ Author: Alexander Knauer <a-x-e@gmx.net>
+ License: Apache 2.0
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include <digitalSTROM/dsuid.h>
+#include <dsvdc/dsvdc.h>
+
+#include "klafs.h"
+
+/* per thread region allocator for the temporary data of one poll cycle or one
+ * command: request bodies, the members of parsed responses and scene copies.
+ * A cycle is opened by arena_begin() (timer callbacks and dsvdc callbacks are
+ * wrapped in one) and memory allocated within it stays valid until the
+ * outermost arena_end(), which releases everything at once by resetting the
+ * fill level of the chunks. The chunks are kept for the next cycle, so a
+ * steady state poll or command does not touch the heap.
+ */
+
+#define ARENA_CHUNK_SIZE 8192
+#define ARENA_ALIGN 16
+
+typedef struct arena_chunk {
+  struct arena_chunk *next;
+  size_t size;
+  size_t used;
+  char data[];
+} arena_chunk_t;
+
+typedef struct arena {
+  arena_chunk_t *first;
+  arena_chunk_t *current;
+  int depth;
+} arena_t;
+
+static __thread arena_t g_arena;
+
+void arena_begin() {
+  g_arena.depth++;
+}
+
+/* the outermost end releases all memory of the cycle, by resetting the chunks it used (normally one) */
+void arena_end() {
+  if (g_arena.depth <= 0) {
+    vdc_report(LOG_ERR, "arena: end without begin\n");
+    return;
+  }
+  if (--g_arena.depth > 0) {
+    return;
+  }
+  /* only the chunks used in this cycle have a fill level to reset */
+  for (arena_chunk_t *chunk = g_arena.first; chunk != NULL; chunk = chunk->next) {
+    bool last = chunk == g_arena.current;
+    chunk->used = 0;
+    if (last) {
+      break;
+    }
+  }
+  g_arena.current = g_arena.first;
+}
+
+static arena_chunk_t* arena_new_chunk(size_t size) {
+  size_t capacity = size > ARENA_CHUNK_SIZE ? size : ARENA_CHUNK_SIZE;
+  arena_chunk_t *chunk = malloc(sizeof(arena_chunk_t) + capacity);
+  if (chunk == NULL) {
+    return NULL;
+  }
+  chunk->next = NULL;
+  chunk->size = capacity;
+  chunk->used = 0;
+  return chunk;
+}
+
+/* memory valid until the end of the current cycle of the calling thread; NULL
+ * outside of a cycle or if out of memory
+ */
+void* arena_alloc(size_t size) {
+  if (g_arena.depth <= 0) {
+    vdc_report(LOG_ERR, "arena: allocation of %zu bytes outside of a cycle\n", size);
+    return NULL;
+  }
+  size = (size + ARENA_ALIGN - 1) & ~((size_t) ARENA_ALIGN - 1);
+
+  arena_chunk_t *chunk = g_arena.current;
+  while (chunk != NULL && chunk->used + size > chunk->size) {
+    /* following chunks were kept from earlier cycles and are empty */
+    if (chunk->next == NULL) {
+      chunk->next = arena_new_chunk(size);
+    } else if (chunk->next->size < size) {
+      arena_chunk_t *bigger = arena_new_chunk(size);
+      if (bigger != NULL) {
+        bigger->next = chunk->next;
+      }
+      chunk->next = bigger;
+    }
+    chunk = chunk->next;
+  }
+  if (chunk == NULL && g_arena.first == NULL) {
+    chunk = g_arena.first = arena_new_chunk(size);
+  }
+  if (chunk == NULL) {
+    vdc_report(LOG_ERR, "arena: out of memory for %zu bytes\n", size);
+    return NULL;
+  }
+
+  g_arena.current = chunk;
+  void *ptr = chunk->data + chunk->used;
+  chunk->used += size;
+  return ptr;
+}
+
+/* gives back the tail of the last allocation ptr, which keeps its first size bytes */
+void arena_shrink(void *ptr, size_t size) {
+  arena_chunk_t *chunk = g_arena.current;
+  if (chunk == NULL || (char *) ptr < chunk->data || (char *) ptr >= chunk->data + chunk->used) {
+    return;
+  }
+  size_t offset = (char *) ptr - chunk->data;
+  size_t used = offset + ((size + ARENA_ALIGN - 1) & ~((size_t) ARENA_ALIGN - 1));
+  if (used < chunk->used) {
+    chunk->used = used;
+  }
+}
+
+char* arena_strndup(const char *s, size_t length) {
+  char *copy = arena_alloc(length + 1);
+  if (copy != NULL) {
+    memcpy(copy, s, length);
+    copy[length] = '\0';
+  }
+  return copy;
+}
+
+/* frees the chunks of the calling thread, before it exits */
+void arena_release() {
+  arena_chunk_t *chunk = g_arena.first;
+  while (chunk != NULL) {
+    arena_chunk_t *next = chunk->next;
+    free(chunk);
+    chunk = next;
+  }
+  memset(&g_arena, 0, sizeof(g_arena));
+}
@@ -0,0 +1,308 @@
+/*
+ Author: Alexander Knauer <a-x-e@gmx.net>
+ License: Apache 2.0
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+/* bench.c replaces malloc itself */
+#define KLAFS_ALLOC_NO_WRAP
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <getopt.h>
+
+#include <digitalSTROM/dsuid.h>
+#include <dsvdc/dsvdc.h>
+
+#include "klafs.h"
+
+/* microbenchmarks of the hot paths, built and run by "make bench":
+ *
+ *   vdc-klafs-bench [-t ms] [-d debuglevel] [getdata.json ...]
+ *
+ * Every benchmark runs for about -t milliseconds (default 500) on the sensor,
+ * binary and scene tables of klafs.cfg.sample and reports ns/op and heap
+ * allocations/op. GetData responses recorded from the klafs server can be
+ * given as files, they are parsed in addition to the built-in ones. Log
+ * output goes to /dev/null, the debug level (default LOG_WARNING, as the
+ * daemon) decides how much of it is formatted.
+ */
+
+/* glibc lets the program replace malloc, all allocations including those of
+ * libc and libdsvdc are counted
+ */
+#ifdef __GLIBC__
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+static unsigned long g_bench_allocs = 0;
+
+void *malloc(size_t size) {
+  g_bench_allocs++;
+  return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size) {
+  g_bench_allocs++;
+  return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+  g_bench_allocs++;
+  return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr) {
+  __libc_free(ptr);
+}
+
+#define BENCH_ALLOCS() g_bench_allocs
+#else
+#define BENCH_ALLOCS() 0UL
+#endif
+
+/* GetData responses of a KLAFS S1, idle and heating up */
+static const char *g_bench_getdata_idle =
+  "{\"saunaId\":\"00000000-0000-0000-0000-000000000000\",\"saunaSelected\":true,\"sanariumSelected\":false,"
+  "\"irSelected\":false,\"selectedSaunaTemperature\":85,\"selectedSanariumTemperature\":50,\"selectedIrTemperature\":0,"
+  "\"selectedHumLevel\":0,\"selectedIrLevel\":0,\"selectedHour\":18,\"selectedMinute\":30,\"isConnected\":true,"
+  "\"isPoweredOn\":false,\"isReadyForUse\":false,\"currentTemperature\":21,\"currentHumidity\":0,\"statusCode\":0,"
+  "\"statusMessage\":null,\"showBathingHour\":false,\"bathingHours\":0,\"bathingMinutes\":0,\"currentHumidityStatus\":0,"
+  "\"currentTemperatureStatus\":0,\"timeSelected\":false}";
+
+static const char *g_bench_getdata_heating =
+  "{\"saunaId\":\"00000000-0000-0000-0000-000000000000\",\"saunaSelected\":false,\"sanariumSelected\":true,"
+  "\"irSelected\":false,\"selectedSaunaTemperature\":85,\"selectedSanariumTemperature\":55,\"selectedIrTemperature\":0,"
+  "\"selectedHumLevel\":6,\"selectedIrLevel\":0,\"selectedHour\":18,\"selectedMinute\":30,\"isConnected\":true,"
+  "\"isPoweredOn\":true,\"isReadyForUse\":false,\"currentTemperature\":47,\"currentHumidity\":31,\"statusCode\":0,"
+  "\"statusMessage\":null,\"showBathingHour\":true,\"bathingHours\":2,\"bathingMinutes\":0,\"currentHumidityStatus\":1,"
+  "\"currentTemperatureStatus\":1,\"timeSelected\":false}";
+
+typedef struct bench {
+  const char *name;
+  void (*fn)(void *arg);
+  void *arg;
+} bench_t;
+
+static uint64_t g_bench_time_ms = 500;
+
+static uint64_t bench_now_ns() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/* doubles the iterations until a run takes the configured time */
+static void bench_run(const bench_t *bench) {
+  uint64_t iterations = 1;
+  uint64_t elapsed;
+  unsigned long allocs;
+
+  /* every call is one arena cycle, as a poll or a command of the daemon */
+  arena_begin();
+  bench->fn(bench->arg);
+  arena_end();
+  for (;;) {
+    unsigned long allocs_start = BENCH_ALLOCS();
+    uint64_t start = bench_now_ns();
+    for (uint64_t i = 0; i < iterations; i++) {
+      arena_begin();
+      bench->fn(bench->arg);
+      arena_end();
+    }
+    elapsed = bench_now_ns() - start;
+    allocs = BENCH_ALLOCS() - allocs_start;
+    if (elapsed >= g_bench_time_ms * 1000000 || iterations >= (1ULL << 40)) {
+      break;
+    }
+    iterations *= 2;
+  }
+
+  printf("%-36s %12llu %12.1f %10.2f\n", bench->name, (unsigned long long) iterations,
+      (double) elapsed / iterations, (double) allocs / iterations);
+}
+
+/* the tables of klafs.cfg.sample */
+static void bench_setup() {
+  static const char *sensors[] = { "currentTemperature", "currentHumidity", "selectedSaunaTemperature", "selectedSanariumTemperature" };
+  static const char *binaries[] = { "isPoweredOn", "isReadyForUse" };
+  static const int scenes[] = { 0, 13, 14, 5, 17 };
+  pthread_mutexattr_t mta;
+
+  pthread_mutexattr_init(&mta);
+  pthread_mutexattr_settype(&mta, PTHREAD_MUTEX_RECURSIVE);
+  pthread_mutex_init(&g_network_mutex, &mta);
+
+  memset(&klafs, 0, sizeof(klafs));
+  klafs.sauna.id = strdup("00000000-0000-0000-0000-000000000000");
+  klafs.sauna.name = strdup("Klafs S1");
+
+  klafs.sauna.sensor_count = sizeof(sensors) / sizeof(sensors[0]);
+  klafs.sauna.sensor_values = calloc(klafs.sauna.sensor_count, sizeof(sensor_value_t));
+  for (int i = 0; i < klafs.sauna.sensor_count; i++) {
+    klafs.sauna.sensor_values[i].value_name = strdup(sensors[i]);
+    klafs.sauna.sensor_values[i].history = sensor_history_new();
+  }
+
+  klafs.sauna.binary_count = sizeof(binaries) / sizeof(binaries[0]);
+  klafs.sauna.binary_values = calloc(klafs.sauna.binary_count, sizeof(binary_value_t));
+  for (int i = 0; i < klafs.sauna.binary_count; i++) {
+    klafs.sauna.binary_values[i].value_name = strdup(binaries[i]);
+  }
+
+  klafs.sauna.scene_count = sizeof(scenes) / sizeof(scenes[0]);
+  klafs.sauna.scenes = calloc(klafs.sauna.scene_count, sizeof(scene_t));
+  klafs.sauna.configured_scenes = calloc(2 + klafs.sauna.scene_count * 12, 1);
+  strcpy(klafs.sauna.configured_scenes, "-");
+  for (int i = 0; i < klafs.sauna.scene_count; i++) {
+    klafs.sauna.scenes[i].dsId = scenes[i];
+    sprintf(klafs.sauna.configured_scenes + strlen(klafs.sauna.configured_scenes), "%d-", scenes[i]);
+  }
+
+  sauna_current_values = calloc(1, sizeof(scene_t));
+  sauna_device = calloc(1, sizeof(klafs_vdcd_t));
+  sauna_device->sauna = &klafs.sauna;
+}
+
+/*
+ * benchmarks
+ */
+
+/* alternates between two responses, every parse sees changed values */
+static void bench_parse(void *arg) {
+  const char **payloads = arg;
+  static int n = 0;
+  const char *payload = payloads[n++ & 1];
+  parse_json_data(payload, strlen(payload), timer_now_ms());
+}
+
+static void bench_parse_file(void *arg) {
+  const char *payload = arg;
+  parse_json_data(payload, strlen(payload), timer_now_ms());
+}
+
+static void bench_find_sensor_first(void *arg __attribute__((unused))) {
+  find_sensor_value_by_name("currentTemperature");
+}
+
+static void bench_find_sensor_last(void *arg __attribute__((unused))) {
+  find_sensor_value_by_name("selectedSanariumTemperature");
+}
+
+static void bench_find_sensor_missing(void *arg __attribute__((unused))) {
+  find_sensor_value_by_name("bathingMinutes");
+}
+
+static void bench_scene_configured(void *arg __attribute__((unused))) {
+  is_scene_configured(17);
+}
+
+static void bench_scene_configuration(void *arg __attribute__((unused))) {
+  get_scene_configuration(17);
+}
+
+static void bench_decode_uri(void *arg __attribute__((unused))) {
+  char decoded[128];
+  decodeURIComponent("CfDJ8%2BaBcD%2FeF%3D%3DgH1-2_3%20klafs%21token%3D%3D", decoded);
+}
+
+static void bench_report(void *arg) {
+  vdc_report((int) (intptr_t) arg, "network: getmeasure returned %s: %d\n", "currentTemperature", 47);
+}
+
+static void bench_envelope(void *arg) {
+  dsvdc_property_t *envelope = push_build_envelope((unsigned int) (uintptr_t) arg, time(NULL));
+  dsvdc_property_free(envelope);
+}
+
+static char* bench_read_file(const char *path) {
+  FILE *f = fopen(path, "rb");
+  if (f == NULL) {
+    return NULL;
+  }
+  fseek(f, 0, SEEK_END);
+  long size = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  char *data = malloc(size + 1);
+  if (data != NULL) {
+    data[fread(data, 1, size, f)] = '\0';
+  }
+  fclose(f);
+  return data;
+}
+
+int main(int argc, char **argv) {
+  static const char *payloads[] = { NULL, NULL };
+  int debug = LOG_WARNING;
+  int o;
+
+  payloads[0] = g_bench_getdata_idle;
+  payloads[1] = g_bench_getdata_heating;
+
+  while ((o = getopt(argc, argv, "t:d:h")) != -1) {
+    switch (o) {
+      case 't':
+        g_bench_time_ms = strtoul(optarg, NULL, 10);
+        break;
+      case 'd':
+        debug = strtol(optarg, NULL, 10);
+        break;
+      default:
+        fprintf(stderr, "usage: %s [-t ms] [-d debuglevel] [getdata.json ...]\n", argv[0]);
+        exit(o == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+  }
+
+  vdc_init_report();
+  vdc_set_debugLevel(debug);
+  if (freopen("/dev/null", "w", stderr) == NULL) {
+    perror("/dev/null");
+    return EXIT_FAILURE;
+  }
+  bench_setup();
+
+  const bench_t benches[] = {
+    { "parse_json_data (idle/heating)", bench_parse, payloads },
+    { "find_sensor_value_by_name (first)", bench_find_sensor_first, NULL },
+    { "find_sensor_value_by_name (last)", bench_find_sensor_last, NULL },
+    { "find_sensor_value_by_name (missing)", bench_find_sensor_missing, NULL },
+    { "is_scene_configured", bench_scene_configured, NULL },
+    { "get_scene_configuration", bench_scene_configuration, NULL },
+    { "decodeURIComponent", bench_decode_uri, NULL },
+    { "vdc_report (printed)", bench_report, (void *) (intptr_t) LOG_ERR },
+    { "vdc_report (filtered)", bench_report, (void *) (intptr_t) LOG_DEBUG },
+    { "push envelope (sensor states)", bench_envelope, (void *) (uintptr_t) PUSH_SENSOR_STATES },
+    { "push envelope (binary input states)", bench_envelope, (void *) (uintptr_t) PUSH_BINARY_INPUT_STATES },
+    { "push envelope (all)", bench_envelope, (void *) (uintptr_t) (PUSH_SENSOR_STATES | PUSH_BINARY_INPUT_STATES | PUSH_DEVICE_STATES) },
+  };
+
+  printf("%-36s %12s %12s %10s\n", "benchmark", "iterations", "ns/op", "allocs/op");
+  for (size_t i = 0; i < sizeof(benches) / sizeof(benches[0]); i++) {
+    bench_run(&benches[i]);
+  }
+
+  for (int i = optind; i < argc; i++) {
+    char *payload = bench_read_file(argv[i]);
+    if (payload == NULL) {
+      printf("%s: cannot read\n", argv[i]);
+      continue;
+    }
+    const char *file = strrchr(argv[i], '/') ? strrchr(argv[i], '/') + 1 : argv[i];
+    char name[64];
+    snprintf(name, sizeof(name), "parse_json_data (%s)", file);
+    bench_t bench = { name, bench_parse_file, payload };
+    bench_run(&bench);
+    free(payload);
+  }
+  arena_release();
+
+  return EXIT_SUCCESS;
+}
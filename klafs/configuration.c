@@ -15,18 +15,219 @@
 #include <libconfig.h>
 #include <utlist.h>
 #include <limits.h>
+#include <stddef.h>
+#include <time.h>
+#include <pthread.h>
 
 #include <digitalSTROM/dsuid.h>
 #include <dsvdc/dsvdc.h>
 
 #include "klafs.h"
 
+/* the file as last read or written by us, to tell our own writes from external changes */
+static struct stat g_config_written;
+static pthread_mutex_t g_config_written_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void config_remember_stat(const struct stat *statbuf) {
+  pthread_mutex_lock(&g_config_written_mutex);
+  g_config_written = *statbuf;
+  pthread_mutex_unlock(&g_config_written_mutex);
+}
+
+/* members of the sensor_values and binary_values entries in klafs.cfg */
+typedef struct config_member {
+  const char *name;
+  int type;
+  size_t offset;
+  size_t size;
+} config_member_t;
+
+#define CONFIG_MEMBER(name, type, struct_type, member) { name, type, offsetof(struct_type, member), sizeof(((struct_type *) 0)->member) }
+
+static const config_member_t g_sensor_members[] = {
+  CONFIG_MEMBER("value_name", CONFIG_TYPE_STRING, sensor_value_t, value_name),
+  CONFIG_MEMBER("sensor_type", CONFIG_TYPE_INT, sensor_value_t, sensor_type),
+  CONFIG_MEMBER("sensor_usage", CONFIG_TYPE_INT, sensor_value_t, sensor_usage),
+};
+
+static const config_member_t g_binary_members[] = {
+  CONFIG_MEMBER("value_name", CONFIG_TYPE_STRING, binary_value_t, value_name),
+  CONFIG_MEMBER("sensor_function", CONFIG_TYPE_INT, binary_value_t, sensor_function),
+};
+
+static int config_setting_int_value(config_setting_t *setting) {
+  if (config_setting_type(setting) == CONFIG_TYPE_BOOL) {
+    return config_setting_get_bool(setting);
+  }
+  return config_setting_get_int(setting);
+}
+
+/* walks the members of one group once and stores the known ones */
+static void config_read_members(config_setting_t *group, void *value, const config_member_t *table, size_t table_size) {
+  int members = config_setting_length(group);
+  for (int m = 0; m < members; m++) {
+    config_setting_t *member = config_setting_get_elem(group, m);
+    const char *name = config_setting_name(member);
+    for (size_t t = 0; t < table_size; t++) {
+      if (strcmp(name, table[t].name) != 0) {
+        continue;
+      }
+      char *field = (char *) value + table[t].offset;
+      if (table[t].type == CONFIG_TYPE_STRING) {
+        const char *sval = config_setting_get_string(member);
+        if (sval != NULL) {
+          *(char **) field = strdup(sval);
+        }
+      } else if (table[t].size == sizeof(uint8_t)) {
+        *(uint8_t *) field = config_setting_int_value(member);
+      } else {
+        *(int *) field = config_setting_int_value(member);
+      }
+      break;
+    }
+  }
+}
+
+/* milliseconds since *since, which is reset to now */
+static void config_elapsed_ms(struct timespec *since, double *elapsed) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  *elapsed = (now.tv_sec - since->tv_sec) * 1000.0 + (now.tv_nsec - since->tv_nsec) / 1000000.0;
+  *since = now;
+}
+
+static void config_read_settings(config_t *config) {
+  int ivalue;
+  const char *svalue;
+
+  if (config_lookup_int(config, "reload_values", (int *) &ivalue))
+    g_reload_values = ivalue;
+  if (config_lookup_int(config, "heatup_poll_margin", (int *) &ivalue))
+    g_heatup_poll_margin = ivalue;
+  if (config_lookup_int(config, "values_max_age", (int *) &ivalue))
+    g_values_max_age = ivalue;
+  if (config_lookup_int(config, "compression", (int *) &ivalue))
+    g_http_compression = ivalue;
+  if (config_lookup_int(config, "watch_config", (int *) &ivalue))
+    g_watch_config = ivalue;
+  if (config_lookup_int(config, "sensor_history", (int *) &ivalue))
+    g_sensor_history = ivalue;
+  if (config_lookup_int(config, "push_coalesce", (int *) &ivalue))
+    g_push_coalesce = ivalue;
+  if (config_lookup_int(config, "schedule_local", (int *) &ivalue))
+    g_schedule_local = ivalue;
+  if (config_lookup_int(config, "session_refresh", (int *) &ivalue))
+    g_session_refresh = ivalue;
+  if (config_lookup_int(config, "schedule_prewarm", (int *) &ivalue))
+    g_schedule_prewarm = ivalue;
+  if (config_lookup_int(config, "stall_threshold", (int *) &ivalue))
+    g_stall_threshold = ivalue;
+  if (config_lookup_int(config, "trace_spans", (int *) &ivalue))
+    g_trace_spans = ivalue;
+  if (config_lookup_string(config, "trace_file", &svalue))
+    snprintf(g_trace_file, sizeof(g_trace_file), "%s", svalue);
+  if (config_lookup_int(config, "zone_id", (int *) &ivalue))
+    g_default_zoneID = ivalue;
+  if (config_lookup_int(config, "debug", (int *) &ivalue)) {
+    if (ivalue <= 10) {
+      vdc_set_debugLevel(ivalue);
+    }
+  }
+}
+
+/* returns the configured sensor values, *count is set to their number */
+static sensor_value_t* config_read_sensor_values(config_t *config, uint8_t *count) {
+  config_setting_t *group = config_lookup(config, "sensor_values");
+  int n = group != NULL ? config_setting_length(group) : 0;
+  if (n > MAX_SENSOR_VALUES) {
+    vdc_report(LOG_WARNING, "only the first %d of %d sensor values are used\n", MAX_SENSOR_VALUES, n);
+    n = MAX_SENSOR_VALUES;
+  }
+  *count = 0;
+  sensor_value_t *values = n > 0 ? calloc(n, sizeof(sensor_value_t)) : NULL;
+  if (values == NULL) {
+    return NULL;
+  }
+  for (int i = 0; i < n; i++) {
+    config_read_members(config_setting_get_elem(group, i), &values[i], g_sensor_members, sizeof(g_sensor_members) / sizeof(g_sensor_members[0]));
+    if (values[i].value_name == NULL) {
+      values[i].value_name = strdup("");
+    }
+  }
+  *count = n;
+  return values;
+}
+
+static binary_value_t* config_read_binary_values(config_t *config, uint8_t *count) {
+  config_setting_t *group = config_lookup(config, "binary_values");
+  int n = group != NULL ? config_setting_length(group) : 0;
+  if (n > MAX_BINARY_VALUES) {
+    vdc_report(LOG_WARNING, "only the first %d of %d binary values are used\n", MAX_BINARY_VALUES, n);
+    n = MAX_BINARY_VALUES;
+  }
+  *count = 0;
+  binary_value_t *values = n > 0 ? calloc(n, sizeof(binary_value_t)) : NULL;
+  if (values == NULL) {
+    return NULL;
+  }
+  for (int i = 0; i < n; i++) {
+    config_read_members(config_setting_get_elem(group, i), &values[i], g_binary_members, sizeof(g_binary_members) / sizeof(g_binary_members[0]));
+    if (values[i].value_name == NULL) {
+      values[i].value_name = strdup("");
+    }
+  }
+  *count = n;
+  return values;
+}
+
+/* list of configured dsIds, "-<dsId>-<dsId>-..." */
+static char* config_scene_list(scene_t *scenes, int count) {
+  char *configured_scenes = malloc(2 + count * 12);
+  if (configured_scenes == NULL) {
+    return NULL;
+  }
+  strcpy(configured_scenes, "-");
+  size_t length = 1;
+  for (int i = 0; i < count; i++) {
+    length += sprintf(configured_scenes + length, "%d-", scenes[i].dsId);
+  }
+  return configured_scenes;
+}
+
+static scene_t* config_read_scenes(config_t *config, uint8_t *count) {
+  config_setting_t *group = config_lookup(config, "sauna.scenes");
+  int n = group != NULL ? config_setting_length(group) : 0;
+  if (n > MAX_SCENES) {
+    vdc_report(LOG_WARNING, "only the first %d of %d scenes are used\n", MAX_SCENES, n);
+    n = MAX_SCENES;
+  }
+  *count = 0;
+  scene_t *scenes = n > 0 ? calloc(n, sizeof(scene_t)) : NULL;
+  if (scenes == NULL) {
+    return NULL;
+  }
+  for (int i = 0; i < n; i++) {
+    config_setting_t *scene = config_setting_get_elem(group, i);
+    int members = config_setting_length(scene);
+    for (int m = 0; m < members; m++) {
+      config_setting_t *member = config_setting_get_elem(scene, m);
+      const scene_field_t *field = scene_field_find(config_setting_name(member));
+      if (field != NULL && (field->flags & (SCENE_FIELD_CONFIG | SCENE_FIELD_ID))) {
+        scene_field_set(&scenes[i], field, config_setting_int_value(member));
+      }
+    }
+  }
+  *count = n;
+  return scenes;
+}
+
 int read_config() {
   config_t config;
   struct stat statbuf;
   int i;
   char *sval;
-  int ivalue;
+  struct timespec phase;
+  double phase_parse = 0, phase_settings = 0, phase_values = 0, phase_scenes = 0, phase_login = 0, phase_device = 0;
 
   if (stat(g_cfgfile, &statbuf) != 0) {
     vdc_report(LOG_ERR, "Could not find configuration file %s\n", g_cfgfile);
@@ -37,12 +238,16 @@ int read_config() {
     return -2;
   }
 
+  clock_gettime(CLOCK_MONOTONIC, &phase);
+
   config_init(&config);
   if (!config_read_file(&config, g_cfgfile)) {
     vdc_report(LOG_ERR, "Error in configuration: l.%d %s\n", config_error_line(&config), config_error_text(&config));
     config_destroy(&config);
     return -3;
   }
+  config_remember_stat(&statbuf);
+  config_elapsed_ms(&phase, &phase_parse);
 
   if (config_lookup_string(&config, "vdcdsuid", (const char **) &sval))
     strncpy(g_vdc_dsuid, sval, sizeof(g_vdc_dsuid));
@@ -65,15 +270,7 @@ int read_config() {
   } else {
     vdc_report(LOG_WARNING, "CONFIG WARNING: parameter 'pin' is not set in klafs.cfg. It is required if you want to use power on / off sauna! \n");  
   }
-  if (config_lookup_int(&config, "reload_values", (int *) &ivalue))
-    g_reload_values = ivalue;
-  if (config_lookup_int(&config, "zone_id", (int *) &ivalue))
-    g_default_zoneID = ivalue;
-  if (config_lookup_int(&config, "debug", (int *) &ivalue)) {
-    if (ivalue <= 10) {
-      vdc_set_debugLevel(ivalue);
-    }
-  }
+  config_read_settings(&config);
   if (config_lookup_string(&config, "sauna.name", (const char **) &sval))
     klafs.sauna.name = strdup(sval);
   if (config_lookup_string(&config, "sauna.id", (const char **) &sval)) {
@@ -83,144 +280,32 @@ int read_config() {
     exit(0);
   }
  
-  char path[128];  
-  i = 0;
-  while(1) {
-    sprintf(path, "sensor_values.s%d", i);
-    if (i < MAX_SENSOR_VALUES && config_lookup(&config, path)) {
-      sensor_value_t* value = &klafs.sauna.sensor_values[i];
-      
-      sprintf(path, "sensor_values.s%d.value_name", i);
-      if (config_lookup_string(&config, path, (const char **) &sval)) {
-        value->value_name = strdup(sval);  
-      } else {
-        value->value_name = strdup("");  
-      }
-      
-      sprintf(path, "sensor_values.s%d.sensor_type", i);
-      if (config_lookup_int(&config, path, (int *) &ivalue))
-        value->sensor_type = ivalue;  
-      
-      sprintf(path, "sensor_values.s%d.sensor_usage", i);
-      if (config_lookup_int(&config, path, (int *) &ivalue))
-        value->sensor_usage = ivalue;  
-      
-      value->is_active = true;
-      
-      i++;
-    } else {
-      while (i < MAX_SENSOR_VALUES) {
-        klafs.sauna.sensor_values[i].is_active = false;
-        i++;
-      }        
-      break;
-    }
-  }
+  config_elapsed_ms(&phase, &phase_settings);
 
-  i = 0;
-  while(1) {
-    sprintf(path, "binary_values.b%d", i);
-    if (i < MAX_BINARY_VALUES && config_lookup(&config, path)) {
-      binary_value_t* value = &klafs.sauna.binary_values[i];
-      
-      sprintf(path, "binary_values.b%d.value_name", i);
-      config_lookup_string(&config, path, (const char **) &sval);
-      value->value_name = strdup(sval);  
-      
-      sprintf(path, "binary_values.b%d.sensor_function", i);
-      config_lookup_int(&config, path, &ivalue);
-      value->sensor_function = ivalue;  
-      
-      value->is_active = true;
-            
-      i++;
-    } else {
-      while (i < MAX_BINARY_VALUES) {
-        klafs.sauna.binary_values[i].is_active = false;
-        i++;
-      }        
-      break;
-    }
-  }
- 
-  klafs.sauna.configured_scenes = strdup("-");
-  i = 0;
-  while(1) {
-    sprintf(path, "sauna.scenes.s%d", i);
-    if (i < MAX_SCENES && config_lookup(&config, path)) {
-      scene_t* value = &klafs.sauna.scenes[i];
-      
-      sprintf(path, "sauna.scenes.s%d.dsId", i);
-      config_lookup_int(&config, path, &ivalue);
-      value->dsId = ivalue;
-      char str[4];
-      sprintf(str, "%d", ivalue);
-      klafs.sauna.configured_scenes = realloc(klafs.sauna.configured_scenes, strlen(klafs.sauna.configured_scenes)+4);
-      strcat(klafs.sauna.configured_scenes, str);
-      strcat(klafs.sauna.configured_scenes, "-");
-      
-      sprintf(path, "sauna.scenes.s%d.isPoweredOn", i);
-      if (config_lookup_int(&config, path, &ivalue)) value->isPoweredOn = ivalue;
-      
-      sprintf(path, "sauna.scenes.s%d.saunaSelected", i);
-      if (config_lookup_int(&config, path, &ivalue)) value->saunaSelected = ivalue;
-      
-      sprintf(path, "sauna.scenes.s%d.sanariumSelected", i);
-      if (config_lookup_int(&config, path, &ivalue)) value->sanariumSelected = ivalue;
-      
-      sprintf(path, "sauna.scenes.s%d.irSelected", i);
-      if (config_lookup_int(&config, path, &ivalue)) value->irSelected = ivalue;
-      
-      sprintf(path, "sauna.scenes.s%d.selectedSaunaTemperature", i);
-      if (config_lookup_int(&config, path, &ivalue)) value->selectedSaunaTemperature = ivalue;
-      
-      sprintf(path, "sauna.scenes.s%d.selectedSanariumTemperature", i);
-      if (config_lookup_int(&config, path, &ivalue)) value->selectedSanariumTemperature = ivalue;
-      
-      sprintf(path, "sauna.scenes.s%d.selectedIrTemperature", i);
-      if (config_lookup_int(&config, path, &ivalue)) value->selectedIrTemperature = ivalue;
-      
-      sprintf(path, "sauna.scenes.s%d.selectedHumLevel", i);
-      if (config_lookup_int(&config, path, &ivalue)) value->selectedHumLevel = ivalue;
-      
-      sprintf(path, "sauna.scenes.s%d.selectedIrLevel", i);
-      if (config_lookup_int(&config, path, &ivalue)) value->selectedIrLevel = ivalue; 
-      
-      sprintf(path, "sauna.scenes.s%d.showBathingHour", i);
-      if (config_lookup_int(&config, path, &ivalue)) value->showBathingHour = ivalue;
-      
-      sprintf(path, "sauna.scenes.s%d.bathingHours", i);
-      if (config_lookup_int(&config, path, &ivalue)) value->bathingHours = ivalue; 
-      
-      sprintf(path, "sauna.scenes.s%d.bathingMinutes", i);
-      if (config_lookup_int(&config, path, &ivalue)) value->bathingMinutes = ivalue; 
-      
-      sprintf(path, "sauna.scenes.s%d.selectedHour", i);
-      if (config_lookup_int(&config, path, &ivalue)) value->selectedHour = ivalue; 
-      
-      sprintf(path, "sauna.scenes.s%d.selectedMinute", i);
-      if (config_lookup_int(&config, path, &ivalue)) value->selectedMinute = ivalue; 
-    
-      i++;
-    } else {
-      while (i < MAX_SCENES) {
-        klafs.sauna.scenes[i].dsId = -1;
-        i++;
-      }        
-      break;
-    }
+  klafs.sauna.sensor_values = config_read_sensor_values(&config, &klafs.sauna.sensor_count);
+  for (i = 0; i < klafs.sauna.sensor_count && g_sensor_history; i++) {
+    klafs.sauna.sensor_values[i].history = sensor_history_new();
   }
+  klafs.sauna.binary_values = config_read_binary_values(&config, &klafs.sauna.binary_count);
+  config_elapsed_ms(&phase, &phase_values);
+
+  klafs.sauna.scenes = config_read_scenes(&config, &klafs.sauna.scene_count);
+  klafs.sauna.configured_scenes = config_scene_list(klafs.sauna.scenes, klafs.sauna.scene_count);
+  config_elapsed_ms(&phase, &phase_scenes);
 
+  arena_begin();
   if (config_lookup_string(&config, "aspxauth", (const char **) &sval)) {
     klafs.aspxauth = strdup(sval);
     klafs_validate_authcookie(klafs.aspxauth);
   } else {
     klafs_login();
   }
+  arena_end();
 
   if (g_cfgfile != NULL) {
     config_destroy(&config);
   }
+  config_elapsed_ms(&phase, &phase_login);
 
   klafs_sauna_t* sauna = &klafs.sauna;
   if (sauna->id) {
@@ -241,9 +326,48 @@ int read_config() {
     dsuid_to_string(&sauna_device->dsuid, sauna_device->dsuidstring);
   }
 
+  identity_rebuild();
+  config_elapsed_ms(&phase, &phase_device);
+
+  vdc_report(LOG_INFO, "configuration loaded in %.1f ms: parse %.1f, settings %.1f, sensor/binary values %.1f, scenes %.1f, authentication %.1f, device %.1f\n",
+      phase_parse + phase_settings + phase_values + phase_scenes + phase_login + phase_device,
+      phase_parse, phase_settings, phase_values, phase_scenes, phase_login, phase_device);
+
 	return 0;
 }
 
+/* writes of the configuration are collected for CONFIG_FLUSH_DELAY_MS on the timer wheel */
+#define CONFIG_FLUSH_DELAY_MS 2000
+
+/* a file edited by hand since we read or wrote it last is reloaded instead of
+ * overwritten, the pending changes are dropped in favour of the edit
+ */
+static void config_flush_write() {
+  if (access(g_cfgfile, F_OK) == 0 && !config_is_own_write()) {
+    vdc_report(LOG_WARNING, "%s was changed externally, reloading it instead of writing the pending changes\n", g_cfgfile);
+    reload_config();
+    return;
+  }
+  write_config();
+}
+
+static void config_flush_timer(void *arg __attribute__((unused))) {
+  config_flush_write();
+}
+
+static klafs_timer_t g_config_flush_timer = KLAFS_TIMER_INIT("config flush", config_flush_timer);
+
+void write_config_deferred() {
+  timer_arm(&g_config_flush_timer, CONFIG_FLUSH_DELAY_MS);
+}
+
+/* writes a pending deferred configuration now, e.g. at shutdown */
+void config_flush() {
+  if (timer_cancel(&g_config_flush_timer)) {
+    config_flush_write();
+  }
+}
+
 int write_config() {
   config_t config;
   config_setting_t* cfg_root;
@@ -254,6 +378,11 @@ int write_config() {
   config_init(&config);
   cfg_root = config_root_setting(&config);
 
+  /* libconfig copies the values, so the tables are only locked while the tree is built;
+   * write_config() runs on the timer thread while dSS callbacks and reloads change them
+   */
+  pthread_mutex_lock(&g_network_mutex);
+
   setting = config_setting_add(cfg_root, "vdcdsuid", CONFIG_TYPE_STRING);
   if (setting == NULL) {
     setting = config_setting_get_member(cfg_root, "vdcdsuid");
@@ -298,6 +427,78 @@ int write_config() {
   }
   config_setting_set_int(setting, g_reload_values);
 
+  setting = config_setting_add(cfg_root, "heatup_poll_margin", CONFIG_TYPE_INT);
+  if (setting == NULL) {
+    setting = config_setting_get_member(cfg_root, "heatup_poll_margin");
+  }
+  config_setting_set_int(setting, g_heatup_poll_margin);
+
+  setting = config_setting_add(cfg_root, "values_max_age", CONFIG_TYPE_INT);
+  if (setting == NULL) {
+    setting = config_setting_get_member(cfg_root, "values_max_age");
+  }
+  config_setting_set_int(setting, g_values_max_age);
+
+  setting = config_setting_add(cfg_root, "compression", CONFIG_TYPE_INT);
+  if (setting == NULL) {
+    setting = config_setting_get_member(cfg_root, "compression");
+  }
+  config_setting_set_int(setting, g_http_compression);
+
+  setting = config_setting_add(cfg_root, "watch_config", CONFIG_TYPE_INT);
+  if (setting == NULL) {
+    setting = config_setting_get_member(cfg_root, "watch_config");
+  }
+  config_setting_set_int(setting, g_watch_config);
+
+  setting = config_setting_add(cfg_root, "sensor_history", CONFIG_TYPE_INT);
+  if (setting == NULL) {
+    setting = config_setting_get_member(cfg_root, "sensor_history");
+  }
+  config_setting_set_int(setting, g_sensor_history);
+
+  setting = config_setting_add(cfg_root, "push_coalesce", CONFIG_TYPE_INT);
+  if (setting == NULL) {
+    setting = config_setting_get_member(cfg_root, "push_coalesce");
+  }
+  config_setting_set_int(setting, g_push_coalesce);
+
+  setting = config_setting_add(cfg_root, "schedule_local", CONFIG_TYPE_INT);
+  if (setting == NULL) {
+    setting = config_setting_get_member(cfg_root, "schedule_local");
+  }
+  config_setting_set_int(setting, g_schedule_local);
+
+  setting = config_setting_add(cfg_root, "schedule_prewarm", CONFIG_TYPE_INT);
+  if (setting == NULL) {
+    setting = config_setting_get_member(cfg_root, "schedule_prewarm");
+  }
+  config_setting_set_int(setting, g_schedule_prewarm);
+
+  setting = config_setting_add(cfg_root, "session_refresh", CONFIG_TYPE_INT);
+  if (setting == NULL) {
+    setting = config_setting_get_member(cfg_root, "session_refresh");
+  }
+  config_setting_set_int(setting, g_session_refresh);
+
+  setting = config_setting_add(cfg_root, "stall_threshold", CONFIG_TYPE_INT);
+  if (setting == NULL) {
+    setting = config_setting_get_member(cfg_root, "stall_threshold");
+  }
+  config_setting_set_int(setting, g_stall_threshold);
+
+  setting = config_setting_add(cfg_root, "trace_spans", CONFIG_TYPE_INT);
+  if (setting == NULL) {
+    setting = config_setting_get_member(cfg_root, "trace_spans");
+  }
+  config_setting_set_int(setting, g_trace_spans);
+
+  setting = config_setting_add(cfg_root, "trace_file", CONFIG_TYPE_STRING);
+  if (setting == NULL) {
+    setting = config_setting_get_member(cfg_root, "trace_file");
+  }
+  config_setting_set_string(setting, g_trace_file);
+
   setting = config_setting_add(cfg_root, "zone_id", CONFIG_TYPE_INT);
   if (setting == NULL) {
     setting = config_setting_get_member(cfg_root, "zone_id");
@@ -334,7 +535,7 @@ int write_config() {
 
   i = 0;
   while(1) {
-    if (i < MAX_SCENES && klafs.sauna.scenes[i].dsId != -1) {
+    if (i < klafs.sauna.scene_count) {
       scene_t* value = &klafs.sauna.scenes[i];
      
       sprintf(path, "s%d", i);   
@@ -350,92 +551,16 @@ int write_config() {
       }
       config_setting_set_int(setting, value->dsId);
 
-      setting = config_setting_add(v, "isPoweredOn", CONFIG_TYPE_INT);
-      if (setting == NULL) {
-        setting = config_setting_get_member(v, "isPoweredOn");
-      }
-      config_setting_set_int(setting, value->isPoweredOn);
-                  
-      if (value->isPoweredOn) {
-        setting = config_setting_add(v, "saunaSelected", CONFIG_TYPE_INT);
-        if (setting == NULL) {
-          setting = config_setting_get_member(v, "saunaSelected");
-        }
-        config_setting_set_int(setting, value->saunaSelected);
-        
-        setting = config_setting_add(v, "sanariumSelected", CONFIG_TYPE_INT);
-        if (setting == NULL) {
-          setting = config_setting_get_member(v, "sanariumSelected");
-        }
-        config_setting_set_int(setting, value->sanariumSelected);
-        
-        setting = config_setting_add(v, "irSelected", CONFIG_TYPE_INT);
-        if (setting == NULL) {
-          setting = config_setting_get_member(v, "irSelected");
-        }
-        config_setting_set_int(setting, value->irSelected);
-        
-        setting = config_setting_add(v, "selectedSaunaTemperature", CONFIG_TYPE_INT);
-        if (setting == NULL) {
-          setting = config_setting_get_member(v, "selectedSaunaTemperature");
-        }
-        config_setting_set_int(setting, value->selectedSaunaTemperature);
-        
-        setting = config_setting_add(v, "selectedSanariumTemperature", CONFIG_TYPE_INT);
-        if (setting == NULL) {
-          setting = config_setting_get_member(v, "selectedSanariumTemperature");
-        }
-        config_setting_set_int(setting, value->selectedSanariumTemperature);
-        
-        setting = config_setting_add(v, "selectedIrTemperature", CONFIG_TYPE_INT);
-        if (setting == NULL) {
-          setting = config_setting_get_member(v, "selectedIrTemperature");
-        }
-        config_setting_set_int(setting, value->selectedIrTemperature);
-        
-        setting = config_setting_add(v, "selectedHumLevel", CONFIG_TYPE_INT);
-        if (setting == NULL) {
-          setting = config_setting_get_member(v, "selectedHumLevel");
+      for (size_t f = 0; f < g_scene_field_count; f++) {
+        const scene_field_t *field = &g_scene_fields[f];
+        if (!(field->flags & SCENE_FIELD_CONFIG) || ((field->flags & SCENE_FIELD_POWER_ON) && !value->isPoweredOn)) {
+          continue;
         }
-        config_setting_set_int(setting, value->selectedHumLevel);
-        
-        setting = config_setting_add(v, "selectedIrLevel", CONFIG_TYPE_INT);
+        setting = config_setting_add(v, field->name, CONFIG_TYPE_INT);
         if (setting == NULL) {
-          setting = config_setting_get_member(v, "selectedIrLevel");
+          setting = config_setting_get_member(v, field->name);
         }
-        config_setting_set_int(setting, value->selectedIrLevel);
-        
-        setting = config_setting_add(v, "showBathingHour", CONFIG_TYPE_INT);
-        if (setting == NULL) {
-          setting = config_setting_get_member(v, "showBathingHour");
-        }
-        config_setting_set_int(setting, value->showBathingHour);
-        
-        setting = config_setting_add(v, "bathingHours", CONFIG_TYPE_INT);
-        if (setting == NULL) {
-          setting = config_setting_get_member(v, "bathingHours");
-        }
-        config_setting_set_int(setting, value->bathingHours);
-        
-        setting = config_setting_add(v, "bathingMinutes", CONFIG_TYPE_INT);
-        if (setting == NULL) {
-          setting = config_setting_get_member(v, "bathingMinutes");
-        }
-        config_setting_set_int(setting, value->bathingMinutes);
-        
-        setting = config_setting_add(v, "selectedHour", CONFIG_TYPE_INT);
-        if (setting == NULL) {
-          setting = config_setting_get_member(v, "selectedHour");
-        }
-        config_setting_set_int(setting, value->selectedHour);
-        
-        setting = config_setting_add(v, "selectedMinute", CONFIG_TYPE_INT);
-        if (setting == NULL) {
-          setting = config_setting_get_member(v, "selectedMinute");
-        }
-        config_setting_set_int(setting, value->selectedMinute);
-        
-        
+        config_setting_set_int(setting, scene_field_get(value, field));
       }
       i++;
     } else {
@@ -452,7 +577,7 @@ int write_config() {
   
   i = 0;
   while(1) {
-    if (i < MAX_BINARY_VALUES && klafs.sauna.binary_values[i].value_name != NULL) {
+    if (i < klafs.sauna.binary_count) {
       binary_value_t* value = &klafs.sauna.binary_values[i];
       
       sprintf(path, "b%d", i);   
@@ -485,7 +610,7 @@ int write_config() {
   
   i = 0;
   while(1) {
-    if (i < MAX_SENSOR_VALUES && klafs.sauna.sensor_values[i].value_name != NULL) {
+    if (i < klafs.sauna.sensor_count) {
       sensor_value_t* value = &klafs.sauna.sensor_values[i];
       
       sprintf(path, "s%d", i);   
@@ -515,6 +640,8 @@ int write_config() {
     }   
   } 
 
+  pthread_mutex_unlock(&g_network_mutex);
+
   char tmpfile[PATH_MAX];
   sprintf(tmpfile, "%s.cfg.new", g_cfgfile);
 
@@ -523,7 +650,11 @@ int write_config() {
     vdc_report(LOG_ERR, "Error while writing new configuration file %s\n", tmpfile);
     unlink(tmpfile);
   } else {
-    rename(tmpfile, g_cfgfile);
+    pthread_mutex_lock(&g_config_written_mutex);
+    if (rename(tmpfile, g_cfgfile) == 0) {
+      stat(g_cfgfile, &g_config_written);
+    }
+    pthread_mutex_unlock(&g_config_written_mutex);
   }
 
   config_destroy(&config);
@@ -533,9 +664,9 @@ int write_config() {
 
 sensor_value_t* find_sensor_value_by_name(char *key) {
   sensor_value_t* value;
-  for (int i = 0; i < MAX_SENSOR_VALUES; i++) {
+  for (int i = 0; i < klafs.sauna.sensor_count; i++) {
     value = &klafs.sauna.sensor_values[i];
-    if (value->value_name != NULL && strcasecmp(key, value->value_name) == 0) {
+    if (strcasecmp(key, value->value_name) == 0) {
         return value;
     }
   }
@@ -545,9 +676,9 @@ sensor_value_t* find_sensor_value_by_name(char *key) {
 
 binary_value_t* find_binary_value_by_name(char *key) {
   binary_value_t* value;
-  for (int i = 0; i < MAX_BINARY_VALUES; i++) {
+  for (int i = 0; i < klafs.sauna.binary_count; i++) {
     value = &klafs.sauna.binary_values[i];
-    if (value->value_name != NULL && strcasecmp(key, value->value_name) == 0) {
+    if (strcasecmp(key, value->value_name) == 0) {
       return value;
     }
   }
@@ -556,39 +687,220 @@ binary_value_t* find_binary_value_by_name(char *key) {
 }
 
 void save_scene(int scene) {
-  int i = 0;
   scene_t* value = NULL;
-  while(1) {
-    if (i < MAX_SCENES && klafs.sauna.scenes[i].dsId != -1) {
-      //scene is already configured, so we will reconfigure the existing one
-      if (klafs.sauna.scenes[i].dsId == scene) {
-        value = &klafs.sauna.scenes[i];
-        break;
-      }
-    } else if (i < MAX_SCENES)  {
-      //scene is currently not configured and we have less than MAX_SCENES configured in config file, so we add a new scene config
+
+  pthread_mutex_lock(&g_network_mutex);
+
+  for (int i = 0; i < klafs.sauna.scene_count; i++) {
+    //scene is already configured, so we will reconfigure the existing one
+    if (klafs.sauna.scenes[i].dsId == scene) {
       value = &klafs.sauna.scenes[i];
       break;
-    } else {
-      //scene is not already configured in config file, but we have already MAX_SCENES configured in config file, so we ignore the save scene request
-      break;
     }
-    
-    i++;
   }
-  
+
+  if (value == NULL && klafs.sauna.scene_count < MAX_SCENES) {
+    //scene is currently not configured and we have less than MAX_SCENES configured in config file, so we add a new scene config
+    scene_t *scenes = realloc(klafs.sauna.scenes, (klafs.sauna.scene_count + 1) * sizeof(scene_t));
+    if (scenes != NULL) {
+      klafs.sauna.scenes = scenes;
+      value = &scenes[klafs.sauna.scene_count++];
+      memset(value, 0, sizeof(scene_t));
+      value->dsId = scene;
+
+      char *configured_scenes = config_scene_list(klafs.sauna.scenes, klafs.sauna.scene_count);
+      if (configured_scenes != NULL) {
+        free(klafs.sauna.configured_scenes);
+        klafs.sauna.configured_scenes = configured_scenes;
+      }
+    }
+  }
+  //otherwise the scene is not configured, but we have already MAX_SCENES configured in config file, so we ignore the save scene request
+
   if (value != NULL) {
     value->dsId = scene;
-    value->isPoweredOn = sauna_current_values->isPoweredOn;
-    value->saunaSelected = sauna_current_values->saunaSelected;
-    value->sanariumSelected = sauna_current_values->sanariumSelected;
-    value->irSelected = sauna_current_values->irSelected;
-    value->selectedSaunaTemperature = sauna_current_values->selectedSaunaTemperature;
-    value->selectedSanariumTemperature = sauna_current_values->selectedSanariumTemperature;
-    value->selectedIrTemperature = sauna_current_values->selectedIrTemperature;
-    value->selectedHumLevel = sauna_current_values->selectedHumLevel;
-    value->selectedIrLevel = sauna_current_values->selectedIrLevel;
-    value->bathingHours = sauna_current_values->bathingHours;
-    value->bathingMinutes = sauna_current_values->bathingMinutes;
+    scene_copy_fields(value, sauna_current_values, SCENE_FIELD_SAVE);
+  }
+
+  pthread_mutex_unlock(&g_network_mutex);
+}
+
+/* true if the configuration file is still the one written by write_config() */
+bool config_is_own_write() {
+  struct stat statbuf;
+  bool own;
+
+  if (stat(g_cfgfile, &statbuf) != 0) {
+    return false;
+  }
+  pthread_mutex_lock(&g_config_written_mutex);
+  own = statbuf.st_dev == g_config_written.st_dev && statbuf.st_ino == g_config_written.st_ino &&
+      statbuf.st_size == g_config_written.st_size && statbuf.st_mtime == g_config_written.st_mtime;
+  pthread_mutex_unlock(&g_config_written_mutex);
+  return own;
+}
+
+/* index of the value with the given name in the running configuration, -1 if it is new */
+static int config_find_sensor_value(const char *name) {
+  for (int i = 0; i < klafs.sauna.sensor_count; i++) {
+    if (strcasecmp(klafs.sauna.sensor_values[i].value_name, name) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+static int config_find_binary_value(const char *name) {
+  for (int i = 0; i < klafs.sauna.binary_count; i++) {
+    if (strcasecmp(klafs.sauna.binary_values[i].value_name, name) == 0) {
+      return i;
+    }
   }
+  return -1;
+}
+
+typedef struct config_tables {
+  sensor_value_t *sensor_values;
+  binary_value_t *binary_values;
+  scene_t *scenes;
+  char *configured_scenes;
+  uint8_t sensor_count;
+  uint8_t binary_count;
+  uint8_t scene_count;
+} config_tables_t;
+
+static void config_free_tables(config_tables_t *tables) {
+  for (int i = 0; i < tables->sensor_count; i++) {
+    free(tables->sensor_values[i].value_name);
+    sensor_history_free(tables->sensor_values[i].history);
+  }
+  for (int i = 0; i < tables->binary_count; i++) {
+    free(tables->binary_values[i].value_name);
+  }
+  free(tables->sensor_values);
+  free(tables->binary_values);
+  free(tables->scenes);
+  free(tables->configured_scenes);
+}
+
+/* re-reads the configuration file while running: scenes, sensor and binary
+ * values and the settings are replaced under g_network_mutex, values and
+ * histories of sensors which are still configured are kept. The device is
+ * re-announced only if the sensor or binary input layout changed.
+ */
+int reload_config() {
+  /* the watch thread and a deferred flush on the network thread may both reload */
+  static pthread_mutex_t reload_mutex = PTHREAD_MUTEX_INITIALIZER;
+  struct stat statbuf;
+  config_t config;
+  config_tables_t tables;
+  int sensor_match[MAX_SENSOR_VALUES];
+  int binary_match[MAX_BINARY_VALUES];
+
+  pthread_mutex_lock(&reload_mutex);
+  config_init(&config);
+  if (stat(g_cfgfile, &statbuf) != 0) {
+    vdc_report(LOG_ERR, "reload: configuration file %s not found - keeping the running configuration\n", g_cfgfile);
+    config_destroy(&config);
+    pthread_mutex_unlock(&reload_mutex);
+    return -1;
+  }
+  if (!config_read_file(&config, g_cfgfile)) {
+    vdc_report(LOG_ERR, "reload: error in configuration: l.%d %s - keeping the running configuration\n", config_error_line(&config), config_error_text(&config));
+    config_destroy(&config);
+    pthread_mutex_unlock(&reload_mutex);
+    return -3;
+  }
+  config_remember_stat(&statbuf);
+
+  memset(&tables, 0, sizeof(config_tables_t));
+  tables.sensor_values = config_read_sensor_values(&config, &tables.sensor_count);
+  tables.binary_values = config_read_binary_values(&config, &tables.binary_count);
+  tables.scenes = config_read_scenes(&config, &tables.scene_count);
+  tables.configured_scenes = config_scene_list(tables.scenes, tables.scene_count);
+
+  /* the settings are applied below, but histories are allocated before locking */
+  int history_enabled = g_sensor_history;
+  config_lookup_int(&config, "sensor_history", &history_enabled);
+
+  /* names and histories are only changed here, so matching and allocating needs no lock */
+  bool layout_changed = tables.sensor_count != klafs.sauna.sensor_count || tables.binary_count != klafs.sauna.binary_count;
+  for (int i = 0; i < tables.sensor_count; i++) {
+    sensor_value_t *value = &tables.sensor_values[i];
+    sensor_match[i] = config_find_sensor_value(value->value_name);
+    if (history_enabled && (sensor_match[i] < 0 || klafs.sauna.sensor_values[sensor_match[i]].history == NULL)) {
+      value->history = sensor_history_new();
+    }
+    if (!layout_changed) {
+      sensor_value_t *old = &klafs.sauna.sensor_values[i];
+      layout_changed = strcasecmp(value->value_name, old->value_name) != 0 || value->sensor_type != old->sensor_type || value->sensor_usage != old->sensor_usage;
+    }
+  }
+  for (int i = 0; i < tables.binary_count; i++) {
+    binary_value_t *value = &tables.binary_values[i];
+    binary_match[i] = config_find_binary_value(value->value_name);
+    if (!layout_changed) {
+      binary_value_t *old = &klafs.sauna.binary_values[i];
+      layout_changed = strcasecmp(value->value_name, old->value_name) != 0 || value->sensor_function != old->sensor_function;
+    }
+  }
+
+  pthread_mutex_lock(&g_network_mutex);
+
+  for (int i = 0; i < tables.sensor_count; i++) {
+    if (sensor_match[i] >= 0) {
+      sensor_value_t *value = &tables.sensor_values[i];
+      sensor_value_t *old = &klafs.sauna.sensor_values[sensor_match[i]];
+      value->value = old->value;
+      value->last_value = old->last_value;
+      value->last_query = old->last_query;
+      value->last_reported = old->last_reported;
+      value->polled = old->polled;
+      if (history_enabled && value->history == NULL) {
+        value->history = old->history;
+        old->history = NULL;
+      }
+    }
+  }
+  for (int i = 0; i < tables.binary_count; i++) {
+    if (binary_match[i] >= 0) {
+      binary_value_t *value = &tables.binary_values[i];
+      binary_value_t *old = &klafs.sauna.binary_values[binary_match[i]];
+      value->value = old->value;
+      value->last_value = old->last_value;
+      value->last_query = old->last_query;
+      value->last_reported = old->last_reported;
+      value->polled = old->polled;
+    }
+  }
+
+  /* swap the tables, the old ones are freed after unlocking */
+  config_tables_t old = { klafs.sauna.sensor_values, klafs.sauna.binary_values, klafs.sauna.scenes, klafs.sauna.configured_scenes,
+      klafs.sauna.sensor_count, klafs.sauna.binary_count, klafs.sauna.scene_count };
+  klafs.sauna.sensor_values = tables.sensor_values;
+  klafs.sauna.sensor_count = tables.sensor_count;
+  klafs.sauna.binary_values = tables.binary_values;
+  klafs.sauna.binary_count = tables.binary_count;
+  klafs.sauna.scenes = tables.scenes;
+  klafs.sauna.scene_count = tables.scene_count;
+  klafs.sauna.configured_scenes = tables.configured_scenes;
+  klafs_expected_values_remap(old.binary_values, tables.binary_values, tables.binary_count, binary_match);
+  klafs_values_invalidate();
+
+  config_read_settings(&config);
+
+  if (layout_changed && sauna_device != NULL) {
+    sauna_device->reannounce = true;
+  }
+
+  pthread_mutex_unlock(&g_network_mutex);
+
+  config_free_tables(&old);
+  config_destroy(&config);
+  identity_rebuild();
+  trace_init();
+  pthread_mutex_unlock(&reload_mutex);
+
+  vdc_report(LOG_NOTICE, "reload: configuration %s reloaded%s\n", g_cfgfile, layout_changed ? ", sensor layout changed - announcing device again" : "");
+  return 0;
 }
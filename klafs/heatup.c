@@ -0,0 +1,145 @@
+/*
+ Author: Alexander Knauer <a-x-e@gmx.net>
+ License: Apache 2.0
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <digitalSTROM/dsuid.h>
+#include <dsvdc/dsvdc.h>
+
+#include "klafs.h"
+
+/* heat-up prediction: while the sauna is heating, fit a line through the
+ * currentTemperature samples (least squares with exponential forgetting, so
+ * the rate follows the flattening curve) and predict when the selected
+ * target temperature is reached
+ */
+
+#define HEATUP_FORGETTING 0.85
+#define HEATUP_MIN_SAMPLES 3
+#define HEATUP_MIN_SPAN 300
+#define HEATUP_MIN_RATE (0.1 / 60)
+#define HEATUP_MAX_SLEEP (30 * 60)
+
+typedef struct heatup_estimator {
+  bool heating;
+  time_t start;
+  int target;
+  int samples;
+  time_t last_sample;
+  double w, wt, wy, wtt, wty;
+  double rate;
+  time_t ready_at;
+} heatup_estimator_t;
+
+static heatup_estimator_t g_heatup;
+
+static int heatup_target(scene_t *values) {
+  if (values->saunaSelected) return values->selectedSaunaTemperature;
+  if (values->sanariumSelected) return values->selectedSanariumTemperature;
+  if (values->irSelected) return values->selectedIrTemperature;
+  return 0;
+}
+
+static void heatup_reset(time_t now, int target) {
+  memset(&g_heatup, 0, sizeof(heatup_estimator_t));
+  g_heatup.start = now;
+  g_heatup.target = target;
+}
+
+static void heatup_add_sample(time_t now, double temperature) {
+  double t = now - g_heatup.start;
+
+  g_heatup.w = HEATUP_FORGETTING * g_heatup.w + 1;
+  g_heatup.wt = HEATUP_FORGETTING * g_heatup.wt + t;
+  g_heatup.wy = HEATUP_FORGETTING * g_heatup.wy + temperature;
+  g_heatup.wtt = HEATUP_FORGETTING * g_heatup.wtt + t * t;
+  g_heatup.wty = HEATUP_FORGETTING * g_heatup.wty + t * temperature;
+  g_heatup.samples++;
+  g_heatup.last_sample = now;
+
+  double det = g_heatup.w * g_heatup.wtt - g_heatup.wt * g_heatup.wt;
+  if (g_heatup.samples >= 2 && det > 0) {
+    g_heatup.rate = (g_heatup.w * g_heatup.wty - g_heatup.wt * g_heatup.wy) / det;
+  }
+}
+
+/* returns true if the predicted time to ready changed and should be pushed to DSS;
+ * the caller holds g_network_mutex, the heatupRemaining sensor is written
+ */
+bool heatup_update(scene_t *values, time_t now) {
+  time_t old_ready_at = g_heatup.ready_at;
+  bool heating = values->isPoweredOn && !values->isReadyForUse;
+  int target = heatup_target(values);
+
+  if (!heating) {
+    if (g_heatup.heating) {
+      vdc_report(LOG_INFO, "heatup: finished after %ld seconds, %d samples\n", now - g_heatup.start, g_heatup.samples);
+    }
+    heatup_reset(now, target);
+  } else {
+    if (!g_heatup.heating || g_heatup.target != target) {
+      heatup_reset(now, target);
+      g_heatup.heating = true;
+    }
+    if (g_heatup.last_sample != now) {
+      heatup_add_sample(now, values->currentTemperature);
+    }
+
+    g_heatup.ready_at = 0;
+    if (g_heatup.samples >= HEATUP_MIN_SAMPLES && now - g_heatup.start >= HEATUP_MIN_SPAN && g_heatup.rate > HEATUP_MIN_RATE) {
+      double remaining = (target - values->currentTemperature) / g_heatup.rate;
+      g_heatup.ready_at = now + (remaining > 0 ? (time_t) remaining : 0);
+    }
+    vdc_report(LOG_DEBUG, "heatup: %d of %d C, rate %.2f C/min, ready in %ld seconds\n", values->currentTemperature, target,
+        g_heatup.rate * 60, g_heatup.ready_at ? g_heatup.ready_at - now : -1L);
+  }
+
+  sensor_value_t *svalue = find_sensor_value_by_name("heatupRemaining");
+  if (svalue != NULL) {
+    double remaining = g_heatup.ready_at > now ? g_heatup.ready_at - now : 0;
+    svalue->last_value = svalue->value;
+    svalue->value = remaining;
+    svalue->last_query = now;
+    sensor_history_record(svalue, now);
+    return svalue->last_reported == 0 || svalue->last_value != svalue->value;
+  }
+
+  return old_ready_at != g_heatup.ready_at;
+}
+
+/* time of the next poll while heating up: sleep until shortly before the
+ * predicted crossing instead of polling at the fixed reload interval;
+ * returns 0 if there is no usable prediction
+ */
+time_t heatup_next_poll(time_t now) {
+  /* the estimator is updated under g_network_mutex, also from dSS callbacks */
+  pthread_mutex_lock(&g_network_mutex);
+  bool heating = g_heatup.heating;
+  time_t ready_at = g_heatup.ready_at;
+  pthread_mutex_unlock(&g_network_mutex);
+
+  if (!heating || ready_at == 0) {
+    return 0;
+  }
+
+  time_t remaining = ready_at - now;
+  time_t margin = remaining / 5;
+  if (margin < g_heatup_poll_margin) {
+    margin = g_heatup_poll_margin;
+  }
+  if (remaining - margin > HEATUP_MAX_SLEEP) {
+    return now + HEATUP_MAX_SLEEP;
+  }
+  if (remaining - margin <= 0) {
+    return 0;
+  }
+  return now + remaining - margin;
+}
@@ -0,0 +1,178 @@
+/*
+ Author: Alexander Knauer <a-x-e@gmx.net>
+ License: Apache 2.0
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <digitalSTROM/dsuid.h>
+#include <dsvdc/dsvdc.h>
+
+#include "klafs.h"
+
+/* sensor history: a raw ring of the latest samples plus minute and hour
+ * tiers holding min / max / avg per bucket; all memory is allocated once
+ * per configured sensor value (only with sensor_history = 1), recording
+ * never allocates. Values are kept as float and times as 32 bit seconds
+ * relative to the hour the history was created in.
+ */
+
+static pthread_mutex_t g_history_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+sensor_history_t* sensor_history_new() {
+  sensor_history_t *history = malloc(sizeof(sensor_history_t));
+  if (!history) {
+    vdc_report(LOG_ERR, "history: not enough memory\n");
+    return NULL;
+  }
+  memset(history, 0, sizeof(sensor_history_t));
+  history->base = time(NULL);
+  history->base -= history->base % 3600;
+
+  history->minutes.buckets = history->minute_buckets;
+  history->minutes.size = HISTORY_MINUTE_BUCKETS;
+  history->minutes.width = 60;
+
+  history->hours.buckets = history->hour_buckets;
+  history->hours.size = HISTORY_HOUR_BUCKETS;
+  history->hours.width = 3600;
+
+  return history;
+}
+
+void sensor_history_free(sensor_history_t *history) {
+  free(history);
+}
+
+static uint32_t history_offset(sensor_history_t *history, time_t time) {
+  return time > history->base ? time - history->base : 0;
+}
+
+static void history_tier_add(history_tier_t *tier, uint32_t now, float value) {
+  uint32_t start = now - (now % tier->width);
+  history_bucket_t *bucket = &tier->buckets[tier->head];
+
+  if (tier->count == 0 || bucket->start != start) {
+    if (tier->count > 0) {
+      tier->head = (tier->head + 1) % tier->size;
+      bucket = &tier->buckets[tier->head];
+    }
+    if (tier->count < tier->size) {
+      tier->count++;
+    }
+    bucket->start = start;
+    bucket->min = value;
+    bucket->max = value;
+    bucket->sum = 0;
+    bucket->count = 0;
+  }
+
+  if (value < bucket->min) bucket->min = value;
+  if (value > bucket->max) bucket->max = value;
+  bucket->sum += value;
+  bucket->count++;
+}
+
+void sensor_history_record(sensor_value_t *value, time_t now) {
+  sensor_history_t *history = value->history;
+  if (history == NULL) {
+    return;
+  }
+
+  pthread_mutex_lock(&g_history_mutex);
+
+  uint32_t offset = history_offset(history, now);
+  history->raw_head = (history->raw_head + 1) % HISTORY_RAW_SAMPLES;
+  history->raw[history->raw_head].offset = offset;
+  history->raw[history->raw_head].value = value->value;
+  if (history->raw_count < HISTORY_RAW_SAMPLES) {
+    history->raw_count++;
+  }
+
+  history_tier_add(&history->minutes, offset, value->value);
+  history_tier_add(&history->hours, offset, value->value);
+
+  pthread_mutex_unlock(&g_history_mutex);
+}
+
+static void history_add_tier_property(dsvdc_property_t *reply, const char *name, sensor_history_t *history, history_tier_t *tier) {
+  dsvdc_property_t *tierProp;
+  if (dsvdc_property_new(&tierProp) != DSVDC_OK) {
+    vdc_report(LOG_ERR, "failed to allocate reply property for %s\n", name);
+    return;
+  }
+
+  char index[16];
+  unsigned int first = (tier->head + tier->size - tier->count + 1) % tier->size;
+  for (unsigned int n = 0; n < tier->count; n++) {
+    history_bucket_t *bucket = &tier->buckets[(first + n) % tier->size];
+
+    dsvdc_property_t *nProp;
+    if (dsvdc_property_new(&nProp) != DSVDC_OK) {
+      vdc_report(LOG_ERR, "failed to allocate reply property for %s\n", name);
+      break;
+    }
+    dsvdc_property_add_int(nProp, "time", history->base + bucket->start);
+    dsvdc_property_add_double(nProp, "min", bucket->min);
+    dsvdc_property_add_double(nProp, "max", bucket->max);
+    dsvdc_property_add_double(nProp, "avg", bucket->sum / bucket->count);
+    dsvdc_property_add_uint(nProp, "count", bucket->count);
+
+    snprintf(index, sizeof(index), "%u", n);
+    dsvdc_property_add_property(tierProp, index, &nProp);
+  }
+
+  dsvdc_property_add_property(reply, name, &tierProp);
+}
+
+/* adds the complete history of one sensor value, oldest entries first */
+void sensor_history_add_property(dsvdc_property_t *reply, const char *key, sensor_value_t *value) {
+  sensor_history_t *history = value->history;
+  if (history == NULL) {
+    return;
+  }
+
+  dsvdc_property_t *sensorProp;
+  if (dsvdc_property_new(&sensorProp) != DSVDC_OK) {
+    vdc_report(LOG_ERR, "failed to allocate reply property for history of %s\n", value->value_name);
+    return;
+  }
+  dsvdc_property_add_string(sensorProp, "name", value->value_name);
+
+  pthread_mutex_lock(&g_history_mutex);
+
+  dsvdc_property_t *rawProp;
+  if (dsvdc_property_new(&rawProp) == DSVDC_OK) {
+    char index[16];
+    unsigned int first = (history->raw_head + HISTORY_RAW_SAMPLES - history->raw_count + 1) % HISTORY_RAW_SAMPLES;
+    for (unsigned int n = 0; n < history->raw_count; n++) {
+      history_sample_t *sample = &history->raw[(first + n) % HISTORY_RAW_SAMPLES];
+
+      dsvdc_property_t *nProp;
+      if (dsvdc_property_new(&nProp) != DSVDC_OK) {
+        vdc_report(LOG_ERR, "failed to allocate reply property for history of %s\n", value->value_name);
+        break;
+      }
+      dsvdc_property_add_int(nProp, "time", history->base + sample->offset);
+      dsvdc_property_add_double(nProp, "value", sample->value);
+
+      snprintf(index, sizeof(index), "%u", n);
+      dsvdc_property_add_property(rawProp, index, &nProp);
+    }
+    dsvdc_property_add_property(sensorProp, "raw", &rawProp);
+  }
+
+  history_add_tier_property(sensorProp, "minute", history, &history->minutes);
+  history_add_tier_property(sensorProp, "hour", history, &history->hours);
+
+  pthread_mutex_unlock(&g_history_mutex);
+
+  dsvdc_property_add_property(reply, key, &sensorProp);
+}
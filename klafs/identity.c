@@ -0,0 +1,122 @@
+/*
+ Author: Alexander Knauer <a-x-e@gmx.net>
+ License: Apache 2.0
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <digitalSTROM/dsuid.h>
+#include <dsvdc/dsvdc.h>
+
+#include "klafs.h"
+
+/* identity cache: the mostly static property answers for the vDC and the
+ * vdSD are formatted once when the configuration is loaded and rebuilt on
+ * configuration or zone changes. Property queries only take the read lock,
+ * so they do not wait for a running Klafs request holding g_network_mutex.
+ */
+
+klafs_identity_t *g_identity = NULL;
+static pthread_rwlock_t g_identity_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+static void identity_free(klafs_identity_t *identity) {
+  if (identity == NULL) {
+    return;
+  }
+  free(identity->sensors);
+  free(identity->binaries);
+  free(identity);
+}
+
+/* must be called without g_network_mutex held, it is taken to read the configuration */
+int identity_rebuild() {
+  char hostname[HOST_NAME_MAX + 1];
+
+  klafs_identity_t *identity = calloc(1, sizeof(klafs_identity_t));
+  if (identity == NULL) {
+    vdc_report(LOG_ERR, "identity: out of memory\n");
+    return KLAFS_OUT_OF_MEMORY;
+  }
+
+  memset(hostname, 0, sizeof(hostname));
+  gethostname(hostname, HOST_NAME_MAX);
+  snprintf(identity->vdc_model, sizeof(identity->vdc_model), "Klafs Sauna Controller @%s", hostname);
+
+  pthread_mutex_lock(&g_network_mutex);
+
+  klafs_sauna_t *sauna = &klafs.sauna;
+  const char *id = sauna->id ? sauna->id : "";
+  const char *name = sauna->name ? sauna->name : "";
+
+  snprintf(identity->vdc_display_id, sizeof(identity->vdc_display_id), "%s", id);
+  snprintf(identity->vdc_hardware_guid, sizeof(identity->vdc_hardware_guid), "sauna-id:%s", id);
+  snprintf(identity->vdc_name, sizeof(identity->vdc_name), "Klafs Sauna %s", name);
+  snprintf(identity->name, sizeof(identity->name), "%s", name);
+  snprintf(identity->vendor_guid, sizeof(identity->vendor_guid), "Klafs vDC %s", id);
+  identity->vdc_zone_id = g_default_zoneID;
+  identity->zone_id = sauna->zoneID;
+
+  identity->sensors = calloc(sauna->sensor_count > 0 ? sauna->sensor_count : 1, sizeof(identity_sensor_t));
+  identity->binaries = calloc(sauna->binary_count > 0 ? sauna->binary_count : 1, sizeof(identity_binary_t));
+  if (identity->sensors == NULL || identity->binaries == NULL) {
+    pthread_mutex_unlock(&g_network_mutex);
+    vdc_report(LOG_ERR, "identity: out of memory\n");
+    identity_free(identity);
+    return KLAFS_OUT_OF_MEMORY;
+  }
+
+  for (int i = 0; i < sauna->sensor_count; i++) {
+    identity_sensor_t *sensor = &identity->sensors[i];
+    snprintf(sensor->key, sizeof(sensor->key), "%d", i);
+    snprintf(sensor->name, sizeof(sensor->name), "%s-%s", name, sauna->sensor_values[i].value_name);
+    sensor->sensor_type = sauna->sensor_values[i].sensor_type;
+    sensor->sensor_usage = sauna->sensor_values[i].sensor_usage;
+  }
+  identity->sensor_count = sauna->sensor_count;
+
+  for (int i = 0; i < sauna->binary_count; i++) {
+    identity_binary_t *binary = &identity->binaries[i];
+    snprintf(binary->key, sizeof(binary->key), "%d", i);
+    snprintf(binary->name, sizeof(binary->name), "%s-%s", name, sauna->binary_values[i].value_name);
+    binary->sensor_function = sauna->binary_values[i].sensor_function;
+  }
+  identity->binary_count = sauna->binary_count;
+
+  pthread_mutex_unlock(&g_network_mutex);
+
+  pthread_rwlock_wrlock(&g_identity_lock);
+  klafs_identity_t *old = g_identity;
+  g_identity = identity;
+  pthread_rwlock_unlock(&g_identity_lock);
+
+  identity_free(old);
+
+  vdc_report(LOG_INFO, "identity: cached %d sensor and %d binary input descriptions\n", identity->sensor_count, identity->binary_count);
+  return KLAFS_OK;
+}
+
+/* g_identity may only be dereferenced between these calls */
+void identity_read_lock() {
+  pthread_rwlock_rdlock(&g_identity_lock);
+}
+
+void identity_read_unlock() {
+  pthread_rwlock_unlock(&g_identity_lock);
+}
+
+void identity_cleanup() {
+  pthread_rwlock_wrlock(&g_identity_lock);
+  klafs_identity_t *old = g_identity;
+  g_identity = NULL;
+  pthread_rwlock_unlock(&g_identity_lock);
+
+  identity_free(old);
+}
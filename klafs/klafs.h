@@ -17,56 +17,136 @@
 #define MAX_BINARY_VALUES 15
 #define MAX_SCENES 128
 
+#define HISTORY_RAW_SAMPLES 256
+#define HISTORY_MINUTE_BUCKETS 360
+#define HISTORY_HOUR_BUCKETS 168
+
+/* scene_t schema; every field is listed once with the places it is used in:
+ * SCENE_FIELD_CONFIG   - scene setting in klafs.cfg
+ * SCENE_FIELD_POWER_ON - setting only used (and only written) for power on scenes
+ * SCENE_FIELD_STATE    - reported by the klafs GetData request
+ * SCENE_FIELD_SAVE     - taken from the current sauna values when a scene is saved
+ * SCENE_FIELD_ID       - the dS scene id
+ * flags are stored as bits, integers in the narrowest type holding their range
+ */
+#define SCENE_FIELD_CONFIG 0x01
+#define SCENE_FIELD_POWER_ON 0x02
+#define SCENE_FIELD_STATE 0x04
+#define SCENE_FIELD_SAVE 0x08
+#define SCENE_FIELD_ID 0x10
+
+#define KLAFS_SCENE_FIELDS(BOOL_FIELD, INT_FIELD) \
+  INT_FIELD(int16_t, dsId, SCENE_FIELD_ID) \
+  BOOL_FIELD(isPoweredOn, SCENE_FIELD_CONFIG | SCENE_FIELD_STATE | SCENE_FIELD_SAVE) \
+  BOOL_FIELD(isReadyForUse, SCENE_FIELD_STATE) \
+  BOOL_FIELD(isConnected, SCENE_FIELD_STATE) \
+  INT_FIELD(int16_t, currentTemperature, SCENE_FIELD_STATE) \
+  BOOL_FIELD(saunaSelected, SCENE_FIELD_CONFIG | SCENE_FIELD_POWER_ON | SCENE_FIELD_STATE | SCENE_FIELD_SAVE) \
+  BOOL_FIELD(sanariumSelected, SCENE_FIELD_CONFIG | SCENE_FIELD_POWER_ON | SCENE_FIELD_STATE | SCENE_FIELD_SAVE) \
+  BOOL_FIELD(irSelected, SCENE_FIELD_CONFIG | SCENE_FIELD_POWER_ON | SCENE_FIELD_STATE | SCENE_FIELD_SAVE) \
+  INT_FIELD(int16_t, selectedSaunaTemperature, SCENE_FIELD_CONFIG | SCENE_FIELD_POWER_ON | SCENE_FIELD_STATE | SCENE_FIELD_SAVE) \
+  INT_FIELD(int16_t, selectedSanariumTemperature, SCENE_FIELD_CONFIG | SCENE_FIELD_POWER_ON | SCENE_FIELD_STATE | SCENE_FIELD_SAVE) \
+  INT_FIELD(int16_t, selectedIrTemperature, SCENE_FIELD_CONFIG | SCENE_FIELD_POWER_ON | SCENE_FIELD_STATE | SCENE_FIELD_SAVE) \
+  INT_FIELD(uint8_t, selectedHumLevel, SCENE_FIELD_CONFIG | SCENE_FIELD_POWER_ON | SCENE_FIELD_STATE | SCENE_FIELD_SAVE) \
+  INT_FIELD(uint8_t, selectedIrLevel, SCENE_FIELD_CONFIG | SCENE_FIELD_POWER_ON | SCENE_FIELD_STATE | SCENE_FIELD_SAVE) \
+  BOOL_FIELD(showBathingHour, SCENE_FIELD_CONFIG | SCENE_FIELD_POWER_ON) \
+  BOOL_FIELD(timeSelected, SCENE_FIELD_CONFIG | SCENE_FIELD_POWER_ON) \
+  INT_FIELD(int8_t, selectedHour, SCENE_FIELD_CONFIG | SCENE_FIELD_POWER_ON | SCENE_FIELD_STATE) \
+  INT_FIELD(int8_t, selectedMinute, SCENE_FIELD_CONFIG | SCENE_FIELD_POWER_ON | SCENE_FIELD_STATE) \
+  INT_FIELD(uint8_t, bathingHours, SCENE_FIELD_CONFIG | SCENE_FIELD_POWER_ON | SCENE_FIELD_STATE | SCENE_FIELD_SAVE) \
+  INT_FIELD(uint8_t, bathingMinutes, SCENE_FIELD_CONFIG | SCENE_FIELD_POWER_ON | SCENE_FIELD_STATE | SCENE_FIELD_SAVE)
+
+#define SCENE_BOOL_MEMBER(name, flags) bool name : 1;
+#define SCENE_INT_MEMBER(type, name, flags) type name;
+#define SCENE_NO_BOOL_MEMBER(name, flags)
+#define SCENE_NO_INT_MEMBER(type, name, flags)
+
+/* all flag bits first, then the integers, so the bits share one word */
 typedef struct scene {
-  int dsId;
-  bool isPoweredOn;
-  bool isReadyForUse;
-  bool isConnected;
-  int currentTemperature;
-  bool saunaSelected;
-  bool sanariumSelected;
-  bool irSelected;
-  int selectedSaunaTemperature;
-  int selectedSanariumTemperature;
-  int selectedIrTemperature;
-  int selectedHumLevel;
-  int selectedIrLevel;
-  bool showBathingHour;
-  int selectedHour;
-  int selectedMinute;
-  int bathingHours;
-  int bathingMinutes;
+  KLAFS_SCENE_FIELDS(SCENE_BOOL_MEMBER, SCENE_NO_INT_MEMBER)
+  KLAFS_SCENE_FIELDS(SCENE_NO_BOOL_MEMBER, SCENE_INT_MEMBER)
 } scene_t;
 
+typedef enum {
+  SCENE_FIELD_BOOL,
+  SCENE_FIELD_INT
+} scene_field_type_t;
+
+typedef struct scene_field {
+  const char *name;
+  scene_field_type_t type;
+  int (*get)(const scene_t *scene);
+  void (*set)(scene_t *scene, int value);
+  unsigned int flags;
+} scene_field_t;
+
+typedef struct history_sample {
+  uint32_t offset;   /* seconds since sensor_history_t.base */
+  float value;
+} history_sample_t;
+
+typedef struct history_bucket {
+  uint32_t start;    /* seconds since sensor_history_t.base */
+  uint32_t count;
+  float min;
+  float max;
+  float sum;
+} history_bucket_t;
+
+typedef struct history_tier {
+  history_bucket_t *buckets;
+  unsigned int size;
+  unsigned int head;
+  unsigned int count;
+  time_t width;
+} history_tier_t;
+
+/* about 12.7 KB per sensor value, allocated only with sensor_history = 1 */
+typedef struct sensor_history {
+  time_t base;
+  history_sample_t raw[HISTORY_RAW_SAMPLES];
+  unsigned int raw_head;
+  unsigned int raw_count;
+  history_tier_t minutes;
+  history_tier_t hours;
+  history_bucket_t minute_buckets[HISTORY_MINUTE_BUCKETS];
+  history_bucket_t hour_buckets[HISTORY_HOUR_BUCKETS];
+} sensor_history_t;
+
 typedef struct sensor_value {
-  bool is_active;
   char *value_name;
-  int sensor_type;
-  int sensor_usage;
+  sensor_history_t *history;
   double value;
   double last_value;
   time_t last_query;
   time_t last_reported;
+  uint8_t sensor_type;
+  uint8_t sensor_usage;
+  bool polled;
 } sensor_value_t;
 
 typedef struct binary_value {
-  bool is_active;
   char *value_name;
-  int sensor_function;
-  bool value;
-  bool last_value;
   time_t last_query;
   time_t last_reported;
+  uint8_t sensor_function;
+  bool value;
+  bool last_value;
+  bool polled;
 } binary_value_t;
 
+/* sensor, binary and scene tables are allocated with the configured size */
 typedef struct klafs_sauna {
   dsuid_t dsuid;
   char *id;
   char *name;
   char *configured_scenes;
-  binary_value_t binary_values[MAX_BINARY_VALUES];
-  sensor_value_t sensor_values[MAX_SENSOR_VALUES];
-  scene_t scenes[MAX_SCENES];
+  sensor_value_t *sensor_values;
+  binary_value_t *binary_values;
+  scene_t *scenes;
+  uint8_t sensor_count;
+  uint8_t binary_count;
+  uint8_t scene_count;
   uint16_t zoneID;
 } klafs_sauna_t;
 
@@ -86,9 +166,131 @@ typedef struct klafs_vdcd {
   bool announced;
   bool presentSignaled;
   bool present;
+  bool reannounce;
   klafs_sauna_t* sauna;
 } klafs_vdcd_t;
 
+/* preformatted property answers, see identity.c */
+typedef struct identity_sensor {
+  char key[8];
+  char name[64];
+  uint8_t sensor_type;
+  uint8_t sensor_usage;
+} identity_sensor_t;
+
+typedef struct identity_binary {
+  char key[8];
+  char name[64];
+  uint8_t sensor_function;
+} identity_binary_t;
+
+typedef struct klafs_identity {
+  char vdc_display_id[64];
+  char vdc_hardware_guid[80];
+  char vdc_name[128];
+  char vdc_model[128];
+  char name[64];
+  char vendor_guid[80];
+  uint16_t vdc_zone_id;
+  uint16_t zone_id;
+  identity_sensor_t *sensors;
+  identity_binary_t *binaries;
+  uint8_t sensor_count;
+  uint8_t binary_count;
+} klafs_identity_t;
+
+#define KLAFS_REQUEST_BUFSIZE 2048
+
+typedef enum {
+  KLAFS_REQUEST_LOGIN,
+  KLAFS_REQUEST_GETDATA,
+  KLAFS_REQUEST_START_CABIN,
+  KLAFS_REQUEST_STOP_CABIN,
+  KLAFS_REQUEST_CHANGE_TEMPERATURE,
+  KLAFS_REQUEST_CHANGE_HUMIDITY,
+  KLAFS_REQUEST_SET_MODE,
+  KLAFS_REQUEST_FAVORITE_SELECTED,
+  KLAFS_REQUEST_POST_CONFIG_CHANGE
+} klafs_request_t;
+
+typedef struct klafs_request_params {
+  const char *id;
+  const char *pin;
+  const char *username;
+  const char *password;
+  int temperature;
+  bool sauna_selected;
+  bool sanarium_selected;
+  bool ir_selected;
+  int sauna_temperature;
+  int sanarium_temperature;
+  int ir_temperature;
+  int hum_level;
+  int ir_level;
+  int mode;
+  bool time_selected;
+  int sel_hour;
+  int sel_min;
+} klafs_request_params_t;
+
+typedef struct klafs_stats {
+  unsigned long polls;
+  unsigned long polls_unchanged;
+  unsigned long long bytes_received;
+  unsigned long long bytes_decoded;
+  unsigned long push_requests;
+  unsigned long pushes;
+  unsigned long timers_fired;
+  unsigned long long timer_jitter_total_ms;
+  unsigned long long timer_jitter_max_ms;
+} klafs_stats_t;
+
+/* timer of the timer wheel in timer.c, the callback runs on the network thread */
+typedef struct klafs_timer {
+  struct klafs_timer *prev;
+  struct klafs_timer *next;
+  const char *name;
+  void (*fn)(void *arg);
+  void *arg;
+  uint64_t expires;
+  uint64_t tick;
+  bool armed;
+} klafs_timer_t;
+
+#define KLAFS_TIMER_INIT(name, fn) { NULL, NULL, name, fn, NULL, 0, 0, false }
+
+/* durations in ms, bucket i counts durations below 2^i ms, the last one all longer ones */
+#define STALL_BUCKETS 17
+
+typedef struct stall_histogram {
+  unsigned long count[STALL_BUCKETS];
+  unsigned long stalls;
+  unsigned long long max_ms;
+} stall_histogram_t;
+
+/* member of a flat JSON object read by scan_object(), strings live in the arena */
+typedef enum {
+  SCAN_NULL,
+  SCAN_BOOL,
+  SCAN_INT,
+  SCAN_DOUBLE,
+  SCAN_STRING,
+  SCAN_OTHER
+} scan_type_t;
+
+typedef struct scan_member {
+  char *key;
+  scan_type_t type;
+  int number;
+  bool boolean;
+  char *string;
+} scan_member_t;
+
+/* state groups sent to dSS in one push envelope */
+#define PUSH_SENSOR_STATES 0x01
+#define PUSH_BINARY_INPUT_STATES 0x02
+#define PUSH_DEVICE_STATES 0x04
+
 #define KLAFS_OK 0
 #define KLAFS_OUT_OF_MEMORY -1
 #define KLAFS_AUTH_FAILED -10
@@ -97,6 +299,15 @@ typedef struct klafs_vdcd {
 #define KLAFS_GETMEASURE_FAILED -14
 #define KLAFS_CONFIGCHANGE_FAILED -15
 #define KLAFS_GETREQVERIFYTOKEN_FAILED -16
+#define KLAFS_CONFIGCHANGE_UNSUPPORTED -17
+#define KLAFS_WRITE_FAILED -18
+
+/* parts of the sauna configuration changed by klafs_change_configuration() */
+#define KLAFS_CHANGE_MODE 0x01
+#define KLAFS_CHANGE_TEMPERATURE 0x02
+#define KLAFS_CHANGE_HUMIDITY 0x04
+#define KLAFS_CHANGE_IR_LEVEL 0x08
+#define KLAFS_CHANGE_ALL (KLAFS_CHANGE_MODE | KLAFS_CHANGE_TEMPERATURE | KLAFS_CHANGE_HUMIDITY | KLAFS_CHANGE_IR_LEVEL)
 
 extern const char *g_cfgfile;
 extern int g_shutdown_flag;
@@ -104,13 +315,28 @@ extern klafs_data_t klafs;
 extern klafs_vdcd_t* sauna_device;
 extern pthread_mutex_t g_network_mutex;
 extern scene_t* sauna_current_values;
+extern klafs_stats_t g_stats;
 
 extern char g_vdc_modeluid[33];
 extern char g_vdc_dsuid[35];
 extern char g_lib_dsuid[35];
 
 extern time_t g_reload_values;
+extern time_t g_heatup_poll_margin;
+extern time_t g_values_max_age;
+extern int g_http_compression;
+extern int g_watch_config;
+extern int g_sensor_history;
+extern int g_push_coalesce;
+extern int g_schedule_local;
+extern int g_schedule_prewarm;
+extern int g_session_refresh;
+extern int g_stall_threshold;
+extern int g_trace_spans;
+extern char g_trace_file[256];
+extern dsvdc_t *handle;
 extern int g_default_zoneID;
+extern klafs_identity_t *g_identity;
 
 extern void vdc_new_session_cb(dsvdc_t *handle __attribute__((unused)), void *userdata);
 extern void vdc_ping_cb(dsvdc_t *handle __attribute__((unused)), const char *dsuid, void *userdata __attribute__((unused)));
@@ -125,31 +351,131 @@ extern void vdc_callscene_cb(dsvdc_t *handle __attribute__((unused)), char **dsu
 extern void vdc_savescene_cb(dsvdc_t *handle __attribute__((unused)), char **dsuid, size_t n_dsuid, int32_t scene, int32_t *group, int32_t *zone_id, void *userdata);
 extern void vdc_request_generic_cb(dsvdc_t *handle __attribute__((unused)), char *dsuid, char *method_name, dsvdc_property_t *property, const dsvdc_property_t *properties,  void *userdata);
 
+const char* klafs_render_request(klafs_request_t request, const klafs_request_params_t *params);
 int klafs_login();
 void klafs_validate_authcookie(char *aspxauth);
 int klafs_get_values();
+void klafs_receive_buffer_release();
+void klafs_values_invalidate();
+void klafs_expected_values_remap(const binary_value_t *old_values, binary_value_t *new_values, int new_count, const int *match);
 int klafs_power_off();
 int klafs_power_on();
+int klafs_power_on_at(int hour, int minute);
 int klafs_change_favoriteprogram(scene_t *scene_data);
 int klafs_change_mode(scene_t *scene_data);
 int klafs_change_temperature(scene_t *scene_data);
 int klafs_change_humidity(scene_t *scene_data);
-void push_binary_input_states();
-void push_sensor_data();
-void push_device_states();
+int klafs_change_configuration(scene_t *scene_data, unsigned int changes);
+void push_request(unsigned int groups);
+bool push_pending();
+void push_flush(bool force);
+dsvdc_property_t* push_build_envelope(unsigned int groups, time_t now);
+int schedule_start(scene_t *scene);
+void schedule_cancel();
+
+void timer_init();
+uint64_t timer_now_ms();
+void timer_arm(klafs_timer_t *timer, uint64_t delay_ms);
+bool timer_cancel(klafs_timer_t *timer);
+bool timer_is_armed(klafs_timer_t *timer);
+void timer_run();
+void timer_stop();
+
+uint64_t trace_now_us();
+int trace_init();
+void trace_cleanup();
+void trace_begin();
+void trace_end(const char *name, const char *category);
+unsigned long trace_current();
+void trace_set(unsigned long id);
+void trace_span(const char *name, const char *category, uint64_t start_us, uint64_t end_us, const char *detail);
+void trace_lock(pthread_mutex_t *mutex, const char *name);
+void trace_request_export();
+int trace_export(const char *path);
+void trace_export_pending();
+
+void stall_set_endpoint(const char *url);
+void stall_loop_mark(int wait_secs);
+void stall_add_property(dsvdc_property_t *property, const char *name);
+void stall_ping_cb(dsvdc_t *handle, const char *dsuid, void *userdata);
+bool stall_remove_cb(dsvdc_t *handle, const char *dsuid, void *userdata);
+void stall_new_session_cb(dsvdc_t *handle, void *userdata);
+void stall_end_session_cb(dsvdc_t *handle, void *userdata);
+void stall_getprop_cb(dsvdc_t *handle, const char *dsuid, dsvdc_property_t *property, const dsvdc_property_t *query, void *userdata);
+void stall_setprop_cb(dsvdc_t *handle, const char *dsuid, dsvdc_property_t *property, const dsvdc_property_t *properties, void *userdata);
+void stall_callscene_cb(dsvdc_t *handle, char **dsuid, size_t n_dsuid, int32_t scene, bool force, int32_t *group, int32_t *zone_id, void *userdata);
+void stall_savescene_cb(dsvdc_t *handle, char **dsuid, size_t n_dsuid, int32_t scene, int32_t *group, int32_t *zone_id, void *userdata);
+void stall_request_generic_cb(dsvdc_t *handle, char *dsuid, char *method_name, dsvdc_property_t *property, const dsvdc_property_t *properties, void *userdata);
+
+void arena_begin();
+void arena_end();
+void* arena_alloc(size_t size);
+void arena_shrink(void *ptr, size_t size);
+char* arena_strndup(const char *s, size_t length);
+void arena_release();
+int scan_object(const char *data, size_t size, scan_member_t **members);
+
 bool is_scene_configured();
 scene_t* get_program_configuration(bool saunaSelected, bool sanariumSelected, bool irSelected, int selectedSaunaTemperature, int selectedSanariumTemperature, int selectedIrTemperature, int selectedHumLevel, int selectedIrLevel, int bathingHours, int bathingMinutes, int selectedHour, int selectedMinute);
 scene_t* get_scene_configuration(int scene);
 int decodeURIComponent (char *sSource, char *sDest);
+int parse_json_data(const char *data, size_t size, uint64_t requested_ms);
 sensor_value_t* find_sensor_value_by_name(char *key);
 binary_value_t* find_binary_value_by_name(char *key);
 void save_scene(int scene);
 
+extern const scene_field_t g_scene_fields[];
+extern const size_t g_scene_field_count;
+const scene_field_t* scene_field_find(const char *name);
+int scene_field_get(const scene_t *scene, const scene_field_t *field);
+void scene_field_set(scene_t *scene, const scene_field_t *field, int value);
+void scene_copy_fields(scene_t *dst, const scene_t *src, unsigned int flags);
+
+sensor_history_t* sensor_history_new();
+void sensor_history_free(sensor_history_t *history);
+void sensor_history_record(sensor_value_t *value, time_t now);
+bool heatup_update(scene_t *values, time_t now);
+time_t heatup_next_poll(time_t now);
+void sensor_history_add_property(dsvdc_property_t *reply, const char *key, sensor_value_t *value);
+
 int write_config();
+void write_config_deferred();
+void config_flush();
 int read_config();
+int reload_config();
+bool config_is_own_write();
+int identity_rebuild();
+void identity_read_lock();
+void identity_read_unlock();
+void identity_cleanup();
+void config_watch_start();
+void config_watch_stop();
 
 void vdc_init_report();
 void vdc_set_debugLevel(int debug);
 int vdc_get_debugLevel();
 void vdc_report(int errlevel, const char *fmt, ... );
 void vdc_report_extraLevel(int errlevel, int maxErrlevel, const char *fmt, ... );
+
+/* allocation accounting (./configure --enable-alloc-stats), see alloc.c */
+#ifdef KLAFS_ALLOC_STATS
+void* alloc_malloc(size_t size, const char *file, int line);
+void* alloc_calloc(size_t nmemb, size_t size, const char *file, int line);
+void* alloc_realloc(void *ptr, size_t size, const char *file, int line);
+char* alloc_strdup(const char *s, const char *file, int line);
+void alloc_free(void *ptr);
+void alloc_add_property(dsvdc_property_t *property);
+void alloc_snapshot();
+
+#ifndef KLAFS_ALLOC_NO_WRAP
+#undef strdup
+#define malloc(size) alloc_malloc(size, __FILE__, __LINE__)
+#define calloc(nmemb, size) alloc_calloc(nmemb, size, __FILE__, __LINE__)
+#define realloc(ptr, size) alloc_realloc(ptr, size, __FILE__, __LINE__)
+#define strdup(s) alloc_strdup(s, __FILE__, __LINE__)
+#define free(ptr) alloc_free(ptr)
+#endif
+#else
+#define alloc_add_property(property)
+#define alloc_snapshot()
+#endif
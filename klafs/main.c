@@ -18,7 +18,6 @@
 
 #include <libconfig.h>
 #include <curl/curl.h>
-#include <json.h>
 #include <utlist.h>
 
 #include <digitalSTROM/dsuid.h>
@@ -34,6 +33,7 @@ int g_shutdown_flag = 0;
 klafs_data_t klafs;
 klafs_vdcd_t* sauna_device = NULL;
 scene_t* sauna_current_values = NULL;
+klafs_stats_t g_stats;
 
 /* VDC-API data */
 
@@ -45,14 +45,29 @@ char g_lib_dsuid[35] = { 0, };
 /* Klafs Data */
 
 time_t g_reload_values = 1 * 60;
+time_t g_heatup_poll_margin = 2 * 60;
+time_t g_values_max_age = 10;
+int g_http_compression = 1;
+int g_watch_config = 1;
+int g_sensor_history = 0;
+int g_push_coalesce = 500;
+int g_schedule_local = 0;
+int g_schedule_prewarm = 120;
+int g_session_refresh = 3600;
+int g_stall_threshold = 3000;
+int g_trace_spans = 0;
+char g_trace_file[256] = "/tmp/vdc-klafs-trace.json";
 int g_default_zoneID = 65534;
 
-static time_t g_query_values_time = 0;
-static bool g_network_changes = false;
 pthread_mutex_t g_network_mutex;
 
 dsvdc_t *handle = NULL;
 
+/* the benchmark program (bench.c) links the daemon without its main loop */
+#ifndef KLAFS_BENCH
+
+static bool g_network_changes = false;
+
 #if defined(HAVE_GETOPT_H) && defined(HAVE_GETOPT_LONG)
 #include <getopt.h>
 #define OPTSTR "c:d:h"
@@ -69,40 +84,90 @@ void print_usage() {
 void signal_handler(int signum) {
   if ((signum == SIGINT) || (signum == SIGTERM)) {
     g_shutdown_flag++;
+  } else if (signum == SIGUSR1) {
+    trace_request_export();
   }
 }
 
-void* networkThread(void *arg __attribute__((unused))) {
-  int rc;
-  static time_t last = 0;
-
-  while (!g_shutdown_flag) {
-    sleep(5);
-    time_t now = time(NULL);
-  
-    if (now >= last + 10) {
-      vdc_report(LOG_DEBUG, "Network Thread: time %ld, last time %ld, queryValuesTime %d\n", now, last, g_query_values_time);
-
-      if ( (g_query_values_time <= now)) {        
-        rc = klafs_get_values();
-        if (rc == 0) {                 //getting values from KLAFS API succeeded and some values have changed compared to previous get values
-          g_query_values_time = g_reload_values + now;
-          g_network_changes = true;                  // send to upstream DSS
-          vdc_report(LOG_DEBUG, "changed values detected - sending to DSS\n");
-        } else if (rc == 1) {         //getting values from KLAFS API succeeded but no values have changed compared to previous get values
-          g_query_values_time = g_reload_values + now;
-          g_network_changes = false;                 // no send to upstream DSS  
-          vdc_report(LOG_DEBUG, "sauna values did not change - not sending to DSS\n");
-        } else {                                     //getting values from KLAFS API failed - retry in one minute
-          now = time(NULL);
-          g_query_values_time = 60 + now;
-          g_network_changes = false;                 // no send to upstream DSS  
-          dsvdc_send_pong(handle, sauna_device->dsuidstring);
-        }
-      }
-      last = now;
+/* periodic work of the network thread, run by the timer wheel */
+#define POLL_MIN_INTERVAL 10
+#define POLL_RETRY_INTERVAL 60
+#define STATS_SNAPSHOT_INTERVAL 300
+
+static void poll_values(void *arg);
+static void stats_snapshot(void *arg);
+static void session_refresh(void *arg);
+static klafs_timer_t g_poll_timer = KLAFS_TIMER_INIT("poll", poll_values);
+static klafs_timer_t g_stats_timer = KLAFS_TIMER_INIT("statistics", stats_snapshot);
+static klafs_timer_t g_session_timer = KLAFS_TIMER_INIT("session refresh", session_refresh);
+
+static void poll_values(void *arg __attribute__((unused))) {
+  time_t delay;
+
+  trace_begin();
+  int rc = klafs_get_values();
+  trace_end("poll", "timer");
+  time_t now = time(NULL);
+  if (rc == 0) {                 //getting values from KLAFS API succeeded and some values have changed compared to previous get values
+    delay = g_reload_values;
+    g_network_changes = true;                  // send to upstream DSS
+    vdc_report(LOG_DEBUG, "changed values detected - sending to DSS\n");
+  } else if (rc == 1) {         //getting values from KLAFS API succeeded but no values have changed compared to previous get values
+    delay = g_reload_values;
+    g_network_changes = false;                 // no send to upstream DSS  
+    vdc_report(LOG_DEBUG, "sauna values did not change - not sending to DSS\n");
+  } else {                                     //getting values from KLAFS API failed - retry in one minute
+    delay = POLL_RETRY_INTERVAL;
+    g_network_changes = false;                 // no send to upstream DSS  
+    dsvdc_send_pong(handle, sauna_device->dsuidstring);
+  }
+  if (rc == 0 || rc == 1) {     //sauna is heating up: no need to poll until shortly before it is predicted to be ready
+    time_t heatup_poll = heatup_next_poll(now);
+    if (heatup_poll > now + delay) {
+      vdc_report(LOG_INFO, "sauna heating up - next query in %ld seconds\n", heatup_poll - now);
+      delay = heatup_poll - now;
     }
   }
+  if (delay < POLL_MIN_INTERVAL) {
+    delay = POLL_MIN_INTERVAL;
+  }
+  timer_arm(&g_poll_timer, (uint64_t) delay * 1000);
+}
+
+static void stats_snapshot(void *arg __attribute__((unused))) {
+  static klafs_stats_t last;
+  klafs_stats_t now = g_stats;
+
+  vdc_report(LOG_INFO, "statistics: polls %lu (+%lu), unchanged %lu (+%lu), pushes %lu (+%lu), timers %lu, timer jitter avg %llu ms max %llu ms\n",
+      now.polls, now.polls - last.polls, now.polls_unchanged, now.polls_unchanged - last.polls_unchanged,
+      now.pushes, now.pushes - last.pushes, now.timers_fired,
+      now.timers_fired > 0 ? now.timer_jitter_total_ms / now.timers_fired : 0, now.timer_jitter_max_ms);
+  last = now;
+  alloc_snapshot();
+  timer_arm(&g_stats_timer, STATS_SNAPSHOT_INTERVAL * 1000);
+}
+
+/* checks the klafs session and logs in again if it expired, so a command after a
+ * long idle time (or while polls are skipped during heat-up) does not fail first
+ */
+static void session_refresh(void *arg __attribute__((unused))) {
+  if (g_session_refresh <= 0) {
+    return;
+  }
+  vdc_report(LOG_INFO, "checking klafs session\n");
+  klafs_validate_authcookie(klafs.aspxauth);
+  timer_arm(&g_session_timer, (uint64_t) g_session_refresh * 1000);
+}
+
+void* networkThread(void *arg __attribute__((unused))) {
+  timer_arm(&g_poll_timer, 0);
+  timer_arm(&g_stats_timer, STATS_SNAPSHOT_INTERVAL * 1000);
+  if (g_session_refresh > 0) {
+    timer_arm(&g_session_timer, (uint64_t) g_session_refresh * 1000);
+  }
+  timer_run();
+  arena_release();
+  klafs_receive_buffer_release();
 
   return NULL;
 }
@@ -120,95 +185,6 @@ void announce_device() {
   }
 }
 
-void push_sensor_data() {
-  dsvdc_property_t* pushEnvelope;
-  dsvdc_property_t* propState;  
-  dsvdc_property_t* propDevState;  
-  dsvdc_property_t* prop;
-
-  dsvdc_property_new (&pushEnvelope);
-  dsvdc_property_new (&propState);
-  dsvdc_property_new (&propDevState);
-  
-  int i = 0;
-  while (1) {
-    if (sauna_device->sauna->sensor_values[i].is_active) {
-      double val = sauna_device->sauna->sensor_values[i].value;
-      time_t now = time (NULL);
-
-      if (dsvdc_property_new (&prop) != DSVDC_OK) {
-        vdc_report(LOG_ERR, "create new property failed!");
-        continue;
-      }
-      dsvdc_property_add_double (prop, "value", val);
-      dsvdc_property_add_int (prop, "age", now - sauna_device->sauna->sensor_values[i].last_query);
-      dsvdc_property_add_int (prop, "error", 0);
-
-      char sensorIndex[64];
-      snprintf (sensorIndex, 64, "%d", i);
-      dsvdc_property_add_property (propState, sensorIndex, &prop);
-
-      sauna_device->sauna->sensor_values[i].last_reported = now;
-      
-      i++;
-    } else {
-      break;
-    }
-  }
-  
-  if (dsvdc_property_new (&prop) != DSVDC_OK) {
-    vdc_report(LOG_ERR, "create new property failed!");
-  }
-  dsvdc_property_add_string (prop, "name", "SaunaConnected");
-  dsvdc_property_add_string (prop, "value", "1");
-  dsvdc_property_add_property (propDevState, 0, &prop);
-
-  dsvdc_property_add_property (pushEnvelope, "sensorStates", &propState);
-  dsvdc_property_add_property (pushEnvelope, "deviceStates", &propDevState);
-  dsvdc_push_property (handle, sauna_device->dsuidstring, pushEnvelope);
-  dsvdc_property_free (pushEnvelope);  
-}
-
-void push_binary_input_states() {
-  dsvdc_property_t* pushEnvelope;
-  dsvdc_property_t* propState;
-  dsvdc_property_t* prop;
-
-  dsvdc_property_new (&pushEnvelope);
-  dsvdc_property_new (&propState);
- 
-  int i = 0;
-  while(1) {
-    if (sauna_device->sauna->binary_values[i].is_active) {
-      bool val = sauna_device->sauna->binary_values[i].value;
-      time_t now = time (NULL);
-
-      if (dsvdc_property_new (&prop) != DSVDC_OK) {
-        vdc_report(LOG_ERR, "create new property failed!");
-        continue;
-      }
-
-      dsvdc_property_add_bool (prop, "value", sauna_device->sauna->binary_values[i].value);
-      dsvdc_property_add_int (prop, "age", now - sauna_device->sauna->binary_values[i].last_query);
-      dsvdc_property_add_int (prop, "error", 0);
-
-      char sensorIndex[64];
-      snprintf (sensorIndex, 64, "%d", i);
-      dsvdc_property_add_property (propState, sensorIndex, &prop);
-
-      sauna_device->sauna->binary_values[i].last_reported = now;
-      
-      i++;
-    } else {
-      break;
-    }
-  }
-
-  dsvdc_property_add_property (pushEnvelope, "binaryInputStates", &propState);
-  dsvdc_push_property (handle, sauna_device->dsuidstring, pushEnvelope);
-  dsvdc_property_free (pushEnvelope);     
-}
-
 int main(int argc __attribute__((unused)), char **argv __attribute__((unused))) {
   struct sigaction action;
   pthread_t networkThreadId;
@@ -260,6 +236,11 @@ int main(int argc __attribute__((unused)), char **argv __attribute__((unused)))
     return EXIT_FAILURE;
   }
 
+  if (sigaction(SIGUSR1, &action, NULL) < 0) {
+    vdc_report(LOG_ERR, "Could not register SIGUSR1 handler!\n");
+    return EXIT_FAILURE;
+  }
+
   curl_global_init(CURL_GLOBAL_ALL);
 
   memset(&klafs, 0, sizeof(klafs_data_t));
@@ -314,18 +295,18 @@ int main(int argc __attribute__((unused)), char **argv __attribute__((unused)))
     return EXIT_FAILURE;
   }
 
-  /* connection callbacks */
-  dsvdc_set_ping_callback(handle, vdc_ping_cb);
-  dsvdc_set_remove_callback(handle, vdc_remove_cb);
+  /* connection callbacks; all callbacks are registered through the timing wrappers of stall.c */
+  dsvdc_set_ping_callback(handle, stall_ping_cb);
+  dsvdc_set_remove_callback(handle, stall_remove_cb);
 
   /* setup callbacks */
-  dsvdc_set_new_session_callback(handle, vdc_new_session_cb);
-  dsvdc_set_end_session_callback(handle, vdc_end_session_cb);
-  dsvdc_set_get_property_callback(handle, vdc_getprop_cb);
-  dsvdc_set_set_property_callback(handle, vdc_setprop_cb);
-  dsvdc_set_call_scene_notification_callback(handle, vdc_callscene_cb);
-  dsvdc_set_save_scene_notification_callback(handle, vdc_savescene_cb);
-  dsvdc_set_send_request_generic_request(handle, vdc_request_generic_cb);
+  dsvdc_set_new_session_callback(handle, stall_new_session_cb);
+  dsvdc_set_end_session_callback(handle, stall_end_session_cb);
+  dsvdc_set_get_property_callback(handle, stall_getprop_cb);
+  dsvdc_set_set_property_callback(handle, stall_setprop_cb);
+  dsvdc_set_call_scene_notification_callback(handle, stall_callscene_cb);
+  dsvdc_set_save_scene_notification_callback(handle, stall_savescene_cb);
+  dsvdc_set_send_request_generic_request(handle, stall_request_generic_cb);
 
   /* delegate network access on a separate thread */
   /* avoid to block the dsvdc main loop and vdsm query timeouts */
@@ -333,14 +314,21 @@ int main(int argc __attribute__((unused)), char **argv __attribute__((unused)))
   pthread_mutexattr_init(&mta);
   pthread_mutexattr_settype(&mta, PTHREAD_MUTEX_RECURSIVE);
   pthread_mutex_init(&g_network_mutex, &mta);
+  timer_init();
+  trace_init();
   if (pthread_create(&networkThreadId, NULL, &networkThread, 0) != 0) {
     vdc_report(LOG_ERR, "Network thread initialization failed\n");
     return EXIT_FAILURE;
   }
 
+  config_watch_start();
+
   while (!g_shutdown_flag) {
-    /* let the work function do our timing, 2secs timeout */
-    dsvdc_work(handle, 2);
+    /* let the work function do our timing, 2secs timeout; 1sec while a push is waiting */
+    int wait = push_pending() ? 1 : 2;
+    stall_loop_mark(wait);
+    dsvdc_work(handle, wait);
+    trace_export_pending();
 
     /* do not block here if network thread currently pulls new values,
      * push properties can wait and sent later if lock can be taken
@@ -356,8 +344,23 @@ int main(int argc __attribute__((unused)), char **argv __attribute__((unused)))
       continue;
     }
 
+    /* the sensor layout was changed by a configuration reload: let dSS forget the
+     * device and announce it again with the new descriptions
+     */
+    if (sauna_device->reannounce) {
+      sauna_device->reannounce = false;
+      if (sauna_device->announced) {
+        dsvdc_device_vanished(handle, sauna_device->dsuidstring);
+        sauna_device->announced = false;
+        sauna_device->presentSignaled = false;
+        pthread_mutex_unlock(&g_network_mutex);
+        continue;
+      }
+    }
+
     if (!sauna_device->announced) {
       announce_device();
+      pthread_mutex_unlock(&g_network_mutex);
       continue;
     }
 
@@ -365,12 +368,14 @@ int main(int argc __attribute__((unused)), char **argv __attribute__((unused)))
       if(sauna_device->presentSignaled) {
         dsvdc_device_vanished(handle, sauna_device->dsuidstring);
         sauna_device->presentSignaled = false;
+        pthread_mutex_unlock(&g_network_mutex);
         continue;
       }
     } else {
       if (!sauna_device->presentSignaled) {
         dsvdc_identify_device(handle, sauna_device->dsuidstring);
         sauna_device->presentSignaled = true;
+        pthread_mutex_unlock(&g_network_mutex);
         continue;
       } 
     }
@@ -386,22 +391,39 @@ int main(int argc __attribute__((unused)), char **argv __attribute__((unused)))
 
       vdc_report(LOG_INFO, "Reporting new values from device %p: %s...\n", sauna_device, sauna_device->dsuidstring);
 
-      push_sensor_data();
-      push_binary_input_states(); 
+      push_request(PUSH_SENSOR_STATES | PUSH_BINARY_INPUT_STATES | PUSH_DEVICE_STATES);
     }
 
+    push_flush(false);
+
     pthread_mutex_unlock(&g_network_mutex);
   }
+
+  /* stop the threads before the tables they use are freed */
+  timer_stop();
+  pthread_join(networkThreadId, NULL);
+  config_watch_stop();
+  config_flush();
   
-  for (int i = 0; i < MAX_SENSOR_VALUES; i++) {
+  for (int i = 0; i < klafs.sauna.sensor_count; i++) {
     sensor_value_t* value = &klafs.sauna.sensor_values[i];    
     free(value->value_name);    
+    sensor_history_free(value->history);
   } 
   
-  for (int i = 0; i < MAX_BINARY_VALUES; i++) {
+  for (int i = 0; i < klafs.sauna.binary_count; i++) {
     binary_value_t* value = &klafs.sauna.binary_values[i];    
     free(value->value_name);    
   } 
+
+  free(klafs.sauna.sensor_values);
+  free(klafs.sauna.binary_values);
+  free(klafs.sauna.scenes);
+  free(klafs.sauna.configured_scenes);
+  identity_cleanup();
+  trace_cleanup();
+  arena_release();
+  klafs_receive_buffer_release();
  
   free(sauna_current_values);
   free(klafs.aspxauth);
@@ -409,8 +431,9 @@ int main(int argc __attribute__((unused)), char **argv __attribute__((unused)))
   
   dsvdc_cleanup(handle);
   curl_global_cleanup();
-  pthread_join(networkThreadId, NULL);
   pthread_mutex_destroy(&g_network_mutex);
 
   return EXIT_SUCCESS;
 }
+
+#endif /* KLAFS_BENCH */
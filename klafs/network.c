@@ -14,9 +14,9 @@
 #include <unistd.h>
 #include <ctype.h>
 #include <pthread.h>
+#include <time.h>
 
 #include <curl/curl.h>
-#include <json.h>
 #include <utlist.h>
 
 #include <digitalSTROM/dsuid.h>
@@ -26,7 +26,7 @@
 
 const char *url_getsaunastatus = "https://sauna-app-19.klafs.com/SaunaApp/GetData";
 const char *url_startcabin = "https://sauna-app-19.klafs.com/SaunaApp/StartCabin";
-const char *url_postconfigchange = "https://sauna-app-19.klafs.com//Control/PostConfigChange";
+const char *url_postconfigchange = "https://sauna-app-19.klafs.com/Control/PostConfigChange";
 const char *url_stopcabin = "https://sauna-app-19.klafs.com/SaunaApp/StopCabin";
 const char *url_login = "https://sauna-app-19.klafs.com/Account/Login";
 const char *url_changeTemperature = "https://sauna-app-19.klafs.com/SaunaApp/ChangeTemperature";
@@ -35,11 +35,24 @@ const char *url_changeFavoriteProgram = "https://sauna-app-19.klafs.com/SaunaApp
 const char *url_changeMode = "https://sauna-app-19.klafs.com/SaunaApp/SetMode";
 
 
+/* receive buffer of the calling thread; it is kept across requests, grows
+ * geometrically and is shrunk again if the responses of the last
+ * RECEIVE_TRIM_INTERVAL requests needed much less
+ */
+#define RECEIVE_MIN_CAPACITY 4096
+#define RECEIVE_TRIM_INTERVAL 32
+
 struct memory_struct {
   char *memory;
   size_t size;
+  size_t capacity;
+  size_t high_water;
+  unsigned int requests;
 };
 
+static __thread struct memory_struct g_receive_buffer;
+static __thread long g_response_code;
+
 struct data {
   char trace_ascii; /* 1 or 0 */
 };
@@ -50,10 +63,18 @@ static size_t WriteMemoryCallback(void *contents, size_t size, size_t nmemb, voi
   size_t realsize = size * nmemb;
   struct memory_struct *mem = (struct memory_struct *) userp;
 
-  mem->memory = realloc(mem->memory, mem->size + realsize + 1);
-  if (mem->memory == NULL) {
-    vdc_report(LOG_ERR, "network module: not enough memory (realloc returned NULL)\n");
-    return 0;
+  if (mem->size + realsize + 1 > mem->capacity) {
+    size_t capacity = mem->capacity;
+    while (capacity < mem->size + realsize + 1) {
+      capacity *= 2;
+    }
+    char *memory = realloc(mem->memory, capacity);
+    if (memory == NULL) {
+      vdc_report(LOG_ERR, "network module: not enough memory (realloc returned NULL)\n");
+      return 0;
+    }
+    mem->memory = memory;
+    mem->capacity = capacity;
   }
 
   memcpy(&(mem->memory[mem->size]), contents, realsize);
@@ -162,12 +183,12 @@ void extractTokenFromCookie(char *cookiedata) {
 	
 	ptr = strtok(cookiedata, delimiter);
 	
-	bool tokenfound = FALSE;
+	bool tokenfound = false;
 	while (ptr != NULL) {
 		vdc_report(LOG_DEBUG, "token %s\n", ptr);
 		if (strcmp(ptr, ".ASPXAUTH") == 0) {
 			ptr = strtok(NULL, delimiter);
-			tokenfound = TRUE;
+			tokenfound = true;
 			break;
 		}
 		ptr = strtok(NULL, delimiter);
@@ -204,24 +225,106 @@ void extractRequestVerificationToken(char *s) {
   }
 }
 
-struct memory_struct* http_post_get(bool post, const char *url, const char *htmldata, json_object *jsondata, const char *cookies) {
+static struct memory_struct* receive_buffer_reset() {
+  struct memory_struct *mem = &g_receive_buffer;
+
+  if (mem->memory == NULL) {
+    mem->memory = malloc(RECEIVE_MIN_CAPACITY);
+    if (mem->memory == NULL) {
+      return NULL;
+    }
+    mem->capacity = RECEIVE_MIN_CAPACITY;
+  }
+  mem->size = 0;
+  mem->memory[0] = 0;
+
+  return mem;
+}
+
+static void receive_buffer_trim() {
+  struct memory_struct *mem = &g_receive_buffer;
+
+  if (mem->size > mem->high_water) {
+    mem->high_water = mem->size;
+  }
+  if (++mem->requests < RECEIVE_TRIM_INTERVAL) {
+    return;
+  }
+
+  size_t capacity = mem->capacity;
+  while (capacity > RECEIVE_MIN_CAPACITY && capacity / 4 > mem->high_water) {
+    capacity /= 2;
+  }
+  if (capacity < mem->capacity) {
+    char *memory = realloc(mem->memory, capacity);
+    if (memory != NULL) {
+      vdc_report(LOG_DEBUG, "network: receive buffer trimmed from %zu to %zu bytes\n", mem->capacity, capacity);
+      mem->memory = memory;
+      mem->capacity = capacity;
+    }
+  }
+  mem->high_water = 0;
+  mem->requests = 0;
+}
+
+/* frees the receive buffer of the calling thread, before it exits */
+void klafs_receive_buffer_release() {
+  struct memory_struct *mem = &g_receive_buffer;
+
+  free(mem->memory);
+  memset(mem, 0, sizeof(struct memory_struct));
+}
+
+/* spans of the http phases measured by curl, if a trace is running; the phase
+ * times of curl are counted from the start of the last transfer after redirects
+ */
+static void http_trace_phases(CURL *curl, const char *url, uint64_t start) {
+  curl_off_t redirect = 0, namelookup = 0, connect = 0, appconnect = 0, pretransfer = 0, starttransfer = 0, total = 0;
+
+  if (trace_current() == 0) {
+    return;
+  }
+  curl_easy_getinfo(curl, CURLINFO_REDIRECT_TIME_T, &redirect);
+  curl_easy_getinfo(curl, CURLINFO_NAMELOOKUP_TIME_T, &namelookup);
+  curl_easy_getinfo(curl, CURLINFO_CONNECT_TIME_T, &connect);
+  curl_easy_getinfo(curl, CURLINFO_APPCONNECT_TIME_T, &appconnect);
+  curl_easy_getinfo(curl, CURLINFO_PRETRANSFER_TIME_T, &pretransfer);
+  curl_easy_getinfo(curl, CURLINFO_STARTTRANSFER_TIME_T, &starttransfer);
+  curl_easy_getinfo(curl, CURLINFO_TOTAL_TIME_T, &total);
+
+  uint64_t transfer = start + redirect;
+  if (redirect > 0) {
+    trace_span("redirect", "http", start, transfer, url);
+  }
+  trace_span("dns", "http", transfer, transfer + namelookup, NULL);
+  trace_span("connect", "http", transfer + namelookup, transfer + connect, NULL);
+  if (appconnect > 0) {
+    trace_span("tls", "http", transfer + connect, transfer + appconnect, NULL);
+  }
+  trace_span("wait", "http", transfer + pretransfer, transfer + starttransfer, NULL);
+  trace_span("receive", "http", transfer + starttransfer, start + total, NULL);
+  trace_span("http", "http", start, start + total, url);
+}
+
+/* the returned response lives in the receive buffer of the calling thread and
+ * is valid until the next request on this thread; it must not be freed
+ */
+struct memory_struct* http_post_get(bool post, const char *url, const char *htmldata, const char *jsondata, const char *cookies) {
   CURL *curl;
   CURLcode res;
   struct memory_struct *chunk;
 
-  chunk = malloc(sizeof(struct memory_struct));
+  g_response_code = 0;
+  stall_set_endpoint(url);
+  chunk = receive_buffer_reset();
   if (chunk == NULL) {
     vdc_report(LOG_ERR, "network: not enough memory\n");
     return NULL;
   }
-  chunk->memory = malloc(1);
-  chunk->size = 0;
 
   curl = curl_easy_init();
   if (curl == NULL) {
     vdc_report(LOG_ERR, "network: curl init failure\n");
-    free(chunk->memory);
-    free(chunk);
     return NULL;
   }
       
@@ -242,30 +345,31 @@ struct memory_struct* http_post_get(bool post, const char *url, const char *html
       curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, (long )strlen(htmldata));
     } else {
       char get_url[1024];
-      strcpy(get_url, url);
-      strcat(get_url, htmldata);
+      snprintf(get_url, sizeof(get_url), "%s%s", url, htmldata);
       curl_easy_setopt(curl, CURLOPT_URL, get_url);
     } 
     //headers = curl_slist_append(headers, "Content-Type: application/x-www-form-urlencoded;charset=UTF-8");
   } else if(jsondata != NULL) {
-    curl_easy_setopt(curl, CURLOPT_POSTFIELDS, json_object_to_json_string(jsondata));
+    curl_easy_setopt(curl, CURLOPT_POSTFIELDS, jsondata);
     headers = curl_slist_append(headers, "Content-Type: application/json");
   } else {
     vdc_report(LOG_ERR, "network: post data missing");
     
     curl_slist_free_all(headers);
     curl_easy_cleanup(curl);  
-    free(chunk->memory);
-    free(chunk);
     
     return NULL;
   }
 
   curl_easy_setopt(curl, CURLOPT_USERAGENT, "Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/59.0.3071.71 Safari/537.36");  
   curl_easy_setopt(curl, CURLOPT_TIMEOUT, 42);
-  curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, FALSE);
+  curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, false);
   curl_easy_setopt(curl, CURLOPT_COOKIEFILE, "");  
   curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+  if (g_http_compression) {
+    /* offer all encodings supported by libcurl (gzip, deflate, br), responses are decoded while receiving */
+    curl_easy_setopt(curl, CURLOPT_ACCEPT_ENCODING, "");
+  }
 
   if (cookies != NULL) {
     curl_easy_setopt(curl, CURLOPT_COOKIE, cookies);	
@@ -284,149 +388,261 @@ struct memory_struct* http_post_get(bool post, const char *url, const char *html
     curl_easy_setopt(curl, CURLOPT_VERBOSE, 1L);
   }
   
+  uint64_t perform_start = trace_now_us();
   res = curl_easy_perform(curl);
+  http_trace_phases(curl, url, perform_start);
 
   if (res != CURLE_OK) {
     vdc_report(LOG_ERR, "network: curl_easy_perform() failed: %s\n", curl_easy_strerror(res));
-    
-    if (chunk != NULL) {
-      if (chunk->memory != NULL) {
-        free(chunk->memory);
-      }
-      free(chunk);
-      chunk = NULL;
-    }
+    chunk = NULL;
   } else {
     //vdc_report(LOG_ERR, "Response: %s\n", chunk->memory);    // results in segmentation fault if response is too long
     res = curl_easy_getinfo(curl, CURLINFO_COOKIELIST, &cookielist);
 
     long response_code;
     curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &response_code);
+    g_response_code = response_code;
+
+    curl_off_t body_size = 0;
+    long header_size = 0;
+    curl_easy_getinfo(curl, CURLINFO_SIZE_DOWNLOAD_T, &body_size);
+    curl_easy_getinfo(curl, CURLINFO_HEADER_SIZE, &header_size);
+    g_stats.bytes_received += body_size + header_size;
+    g_stats.bytes_decoded += chunk->size + header_size;
+    vdc_report(LOG_DEBUG, "network: %s received %ld bytes, %zu bytes decoded\n", url, (long) (body_size + header_size), chunk->size + header_size);
 
     if (response_code == 403 || response_code == 404 || response_code == 503) {
       vdc_report(LOG_ERR, "Klafs server response: %d - ignoring response\n", response_code);
-      if (chunk != NULL) {
-        if (chunk->memory != NULL) {
-          free(chunk->memory);
-        }
-        free(chunk);
-        chunk = NULL;
-      }
+      chunk = NULL;
     } 
   }
 
   curl_slist_free_all(headers);
   curl_easy_cleanup(curl);
+  receive_buffer_trim();
 
   return chunk;
 }
 
-int parse_json_data(struct memory_struct *response) {
-  bool changed_values = FALSE;
+/* expected effects of successful commands which have already been pushed to DSS,
+ * reconciled with the sauna values of the first GetData request started after
+ * the command; responses of older requests do not show the effect yet
+ */
+#define MAX_EXPECTED_VALUES 4
+
+typedef struct expected_value {
+  binary_value_t *value;
+  bool expected;
+  time_t since;
+  uint64_t since_ms;
+} expected_value_t;
+
+static expected_value_t g_expected_values[MAX_EXPECTED_VALUES];
+static int g_expected_count = 0;
+
+static void klafs_expect_binary_value(char *key, bool expected, time_t now) {
+  binary_value_t *bvalue = find_binary_value_by_name(key);
+  if (bvalue == NULL) {
+    return;
+  }
+
+  vdc_report(LOG_DEBUG, "network: optimistic update %s: %s\n", key, expected ? "true" : "false");
+  bvalue->last_value = expected;
+  bvalue->value = expected;
+  bvalue->last_query = now;
+
+  for (int i = 0; i < g_expected_count; i++) {
+    if (g_expected_values[i].value == bvalue) {
+      g_expected_values[i].expected = expected;
+      g_expected_values[i].since = now;
+      g_expected_values[i].since_ms = timer_now_ms();
+      return;
+    }
+  }
+  if (g_expected_count < MAX_EXPECTED_VALUES) {
+    g_expected_values[g_expected_count].value = bvalue;
+    g_expected_values[g_expected_count].expected = expected;
+    g_expected_values[g_expected_count].since = now;
+    g_expected_values[g_expected_count].since_ms = timer_now_ms();
+    g_expected_count++;
+  }
+}
+
+/* apply the expected result of a power on / off command to the state snapshot */
+static void klafs_apply_power_state(bool powered_on) {
+  time_t now = time(NULL);
+
+  pthread_mutex_lock(&g_network_mutex);
+  sauna_current_values->isPoweredOn = powered_on;
+  klafs_expect_binary_value("isPoweredOn", powered_on, now);
+  if (!powered_on) {
+    sauna_current_values->isReadyForUse = false;
+    klafs_expect_binary_value("isReadyForUse", false, now);
+  }
+  pthread_mutex_unlock(&g_network_mutex);
+}
+
+/* the binary value table was replaced by a reload, the caller holds g_network_mutex:
+ * expectations follow their value into the new table, those of removed values are dropped
+ */
+void klafs_expected_values_remap(const binary_value_t *old_values, binary_value_t *new_values, int new_count, const int *match) {
+  int kept = 0;
+
+  for (int i = 0; i < g_expected_count; i++) {
+    expected_value_t *exp = &g_expected_values[i];
+    int old_index = exp->value - old_values;
+    for (int j = 0; j < new_count; j++) {
+      if (match[j] == old_index) {
+        exp->value = &new_values[j];
+        g_expected_values[kept++] = *exp;
+        break;
+      }
+    }
+  }
+  g_expected_count = kept;
+}
+
+/* true if a command expects a value newer than a GetData request started at requested_ms */
+static bool klafs_expectation_newer(const binary_value_t *bvalue, uint64_t requested_ms) {
+  for (int i = 0; i < g_expected_count; i++) {
+    if (g_expected_values[i].value == bvalue && g_expected_values[i].since_ms >= requested_ms) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/* returns true if the cloud disagrees with an optimistic update, which then needs a corrective push;
+ * expectations newer than the GetData request started at requested_ms are kept for a later response
+ */
+static bool klafs_reconcile_expected_values(uint64_t requested_ms) {
+  bool rollback = false;
+  int kept = 0;
+
+  for (int i = 0; i < g_expected_count; i++) {
+    expected_value_t *exp = &g_expected_values[i];
+    if (exp->since_ms >= requested_ms) {
+      g_expected_values[kept++] = *exp;
+      continue;
+    }
+    if (exp->value->value != exp->expected) {
+      vdc_report(LOG_NOTICE, "network: %s is %s after %ld seconds, expected %s - correcting DSS\n", exp->value->value_name,
+          exp->value->value ? "true" : "false", time(NULL) - exp->since, exp->expected ? "true" : "false");
+      rollback = true;
+    } else {
+      vdc_report(LOG_DEBUG, "network: %s confirmed\n", exp->value->value_name);
+    }
+  }
+  g_expected_count = kept;
+
+  return rollback;
+}
+
+/* data is the NUL terminated GetData response body, its members are scanned into the arena of the current cycle;
+ * requested_ms is the timer_now_ms() at which the request was started
+ */
+int parse_json_data(const char *data, size_t size, uint64_t requested_ms) {
+  bool changed_values = false;
   time_t now;
     
   now = time(NULL);
-  vdc_report(LOG_DEBUG, "network: klafs sauna values response = %s\n", response->memory);
+  vdc_report(LOG_DEBUG, "network: klafs sauna values response = %s\n", data);
   
-  json_object *jobj = json_tokener_parse(response->memory);
+  /* the whole response is scanned before any value is applied */
+  scan_member_t *members;
+  int count = scan_object(data, size, &members);
   
-  if (NULL == jobj) {
-    vdc_report(LOG_ERR, "network: parsing json data failed, length %d, data:\n%s\n", response->size, response->memory);
+  if (count < 0) {
+    vdc_report(LOG_ERR, "network: parsing json data failed, length %zu, data:\n%s\n", size, data);
     return KLAFS_GETMEASURE_FAILED;
   }
 
-  //pthread_mutex_lock(&g_network_mutex);
+  trace_lock(&g_network_mutex, "network lock");
 
-  json_object_object_foreach(jobj, key, val) {
-    enum json_type type = json_object_get_type(val);
+  for (int m = 0; m < count; m++) {
+    char *key = members[m].key;
+    const scan_member_t *val = &members[m];
     
     sensor_value_t* svalue;
-    binary_value_t* bvalue;
-    
-    //save all relevant data rettrieved from klafs sauna API as current values in memory; in case of saving a scene, these values will be used to save as scene
-    if (strcmp(key, "isPoweredOn") == 0) {
-      sauna_current_values->isPoweredOn = json_object_get_boolean(val);
-    } else if (strcmp(key, "saunaSelected") == 0)  {
-      sauna_current_values->saunaSelected = json_object_get_boolean(val);
-    } else if (strcmp(key, "sanariumSelected") == 0)  {
-      sauna_current_values->sanariumSelected = json_object_get_boolean(val);
-    } else if (strcmp(key, "irSelected") == 0)  {
-      sauna_current_values->irSelected = json_object_get_boolean(val);
-    } else if (strcmp(key, "selectedSaunaTemperature") == 0)  {
-      sauna_current_values->selectedSaunaTemperature = json_object_get_int(val);
-    } else if (strcmp(key, "selectedSanariumTemperature") == 0)  {
-      sauna_current_values->selectedSanariumTemperature = json_object_get_int(val);
-    } else if (strcmp(key, "selectedIrTemperature") == 0)  {
-      sauna_current_values->selectedIrTemperature = json_object_get_int(val);
-    } else if (strcmp(key, "selectedHumLevel") == 0)  {
-      sauna_current_values->selectedHumLevel = json_object_get_int(val);
-    } else if (strcmp(key, "selectedIrLevel") == 0)  {
-      sauna_current_values->selectedIrLevel = json_object_get_int(val);
-    } else if (strcmp(key, "selectedHour") == 0)  {
-      sauna_current_values->selectedHour = json_object_get_int(val);
-    } else if (strcmp(key, "selectedMinute") == 0)  {
-      sauna_current_values->selectedMinute = json_object_get_int(val);
-    } else if (strcmp(key, "bathingHours") == 0)  {
-      sauna_current_values->bathingHours = json_object_get_int(val);
-    } else if (strcmp(key, "bathingMinutes") == 0)  {
-      sauna_current_values->bathingMinutes = json_object_get_int(val);
-    }
-    
+    binary_value_t* bvalue = NULL;
     
     svalue = find_sensor_value_by_name(key);
     if (svalue == NULL) {
       bvalue = find_binary_value_by_name(key);
     }
+    // the request was sent before a command whose effect is still expected: keep the optimistic value
+    if (bvalue != NULL && klafs_expectation_newer(bvalue, requested_ms)) {
+      vdc_report(LOG_DEBUG, "network: %s from a request older than the last command - ignoring\n", key);
+      continue;
+    }
+
+    //save all relevant data rettrieved from klafs sauna API as current values in memory; in case of saving a scene, these values will be used to save as scene
+    const scene_field_t *field = scene_field_find(key);
+    if (field != NULL && (field->flags & SCENE_FIELD_STATE)) {
+      scene_field_set(sauna_current_values, field, field->type == SCENE_FIELD_BOOL ? val->boolean : val->number);
+    }
+    
     if (svalue == NULL && bvalue == NULL) {
       vdc_report(LOG_WARNING, "value %s is not configured for evaluation - ignoring\n", key);
     } else {
-      if (type == json_type_int) {
-        vdc_report(LOG_WARNING, "network: getmeasure returned %s: %d\n", key, json_object_get_int(val));
+      if (val->type == SCAN_INT) {
+        vdc_report(LOG_WARNING, "network: getmeasure returned %s: %d\n", key, val->number);
         
         if (svalue != NULL) {
-          //if ((svalue->last_reported == 0) || (svalue->last_value != json_object_get_int(val)) || (now - svalue->last_reported) > 180) {
-          if ((svalue->last_reported == 0) || (svalue->last_value != json_object_get_int(val))) {
-            changed_values = TRUE;
+          svalue->polled = true;
+          //if ((svalue->last_reported == 0) || (svalue->last_value != val->number) || (now - svalue->last_reported) > 180) {
+          if ((svalue->last_reported == 0) || (svalue->last_value != val->number)) {
+            changed_values = true;
           } 
           svalue->last_value = svalue->value;
-          svalue->value = json_object_get_int(val);
+          svalue->value = val->number;
           svalue->last_query = now;
+          sensor_history_record(svalue, now);
         } else if (bvalue != NULL) {
-          //if ((bvalue->last_reported == 0) || (bvalue->last_value != json_object_get_int(val)) || (now - bvalue->last_reported) > 180) {
-          if ((bvalue->last_reported == 0) || (bvalue->last_value != json_object_get_int(val))) {
-            changed_values = TRUE;
+          bvalue->polled = true;
+          //if ((bvalue->last_reported == 0) || (bvalue->last_value != val->number) || (now - bvalue->last_reported) > 180) {
+          if ((bvalue->last_reported == 0) || (bvalue->last_value != val->number)) {
+            changed_values = true;
           } 
           bvalue->last_value = bvalue->value;
-          bvalue->value = json_object_get_int(val);
+          bvalue->value = val->number;
           bvalue->last_query = now;
         }
-      } else if (type == json_type_boolean) {
-        vdc_report(LOG_WARNING, "network: getmeasure returned %s: %s\n", key, json_object_get_boolean(val)? "true": "false");
+      } else if (val->type == SCAN_BOOL) {
+        vdc_report(LOG_WARNING, "network: getmeasure returned %s: %s\n", key, val->boolean? "true": "false");
           
         if (svalue != NULL) {
-          //if ((svalue->last_reported == 0) || (svalue->last_value != json_object_get_boolean(val)) || (now - svalue->last_reported) > 180) {
-          if ((svalue->last_reported == 0) || (svalue->last_value != json_object_get_boolean(val))) {
-           changed_values = TRUE;
+          svalue->polled = true;
+          //if ((svalue->last_reported == 0) || (svalue->last_value != val->boolean) || (now - svalue->last_reported) > 180) {
+          if ((svalue->last_reported == 0) || (svalue->last_value != val->boolean)) {
+           changed_values = true;
           }
           svalue->last_value = svalue->value;
-          svalue->value = json_object_get_boolean(val);
+          svalue->value = val->boolean;
           svalue->last_query = now;
+          sensor_history_record(svalue, now);
         } else if (bvalue != NULL) {
-          //if ((bvalue->last_reported == 0) || (bvalue->last_value != json_object_get_boolean(val)) || (now - bvalue->last_reported) > 180) {
-          if ((bvalue->last_reported == 0) || (bvalue->last_value != json_object_get_boolean(val))) {
-            changed_values = TRUE;
+          bvalue->polled = true;
+          //if ((bvalue->last_reported == 0) || (bvalue->last_value != val->boolean) || (now - bvalue->last_reported) > 180) {
+          if ((bvalue->last_reported == 0) || (bvalue->last_value != val->boolean)) {
+            changed_values = true;
           }
           bvalue->last_value = bvalue->value;
-          bvalue->value = json_object_get_boolean(val);
+          bvalue->value = val->boolean;
           bvalue->last_query = now;
         }
       }
     }
   }
 
-	pthread_mutex_unlock(&g_network_mutex);
-  
-  json_object_put(jobj);
+  if (klafs_reconcile_expected_values(requested_ms)) {
+    changed_values = true;
+  }
+  if (heatup_update(sauna_current_values, now)) {
+    changed_values = true;
+  }
+
+  pthread_mutex_unlock(&g_network_mutex);
    
   if (changed_values ) {
     return 0;
@@ -434,23 +650,18 @@ int parse_json_data(struct memory_struct *response) {
 }
 
 void klafs_validate_authcookie(char *aspxauth) {
-  char request_body[1024];
-  strcpy(request_body, "?id=");
-  strcat(request_body, klafs.sauna.id);
+  klafs_request_params_t params = { .id = klafs.sauna.id };
+  const char *request_body = klafs_render_request(KLAFS_REQUEST_GETDATA, &params);
   
   struct memory_struct *response = http_post_get(false, url_getsaunastatus, request_body, NULL, klafs.aspxauth);
   
-  vdc_report(LOG_ERR, response->memory);
-  
   if (response == NULL) {
     vdc_report(LOG_ERR, "network: trying sample request with auth cookie failed\n");
   } else {    
+    vdc_report(LOG_DEBUG, "%s\n", response->memory);
     if(strstr(response->memory, "\"LoginRequired\":true") != NULL) {    //seems the authcookie taken from config file does not work => get a new authcookie
       klafs_login();   
     }
-  
-    free(response->memory);
-    free(response);
   }
 }
 
@@ -458,21 +669,20 @@ int klafs_login() {
   vdc_report(LOG_ERR, "Klafs login calling\n");
   struct memory_struct *response = NULL;
 
-  char request_body[1024];
-  strcpy(request_body, "UserName=");
-  strcat(request_body, klafs.username);
-  strcat(request_body, "&Password=");
-  strcat(request_body, klafs.password);
-  
+  klafs_request_params_t params = { .username = klafs.username, .password = klafs.password };
+  const char *request_body = klafs_render_request(KLAFS_REQUEST_LOGIN, &params);
+  if (request_body == NULL) {
+    return KLAFS_AUTH_FAILED;
+  }
 
   response = http_post_get(true, url_login, request_body, NULL, NULL);
-  
-  extractRequestVerificationToken(response->memory);
    
   if (response == NULL) {
     vdc_report(LOG_ERR, "Klafs login failed\n");
     return KLAFS_AUTH_FAILED;
   }
+
+  extractRequestVerificationToken(response->memory);
   vdc_report(LOG_ERR, "Klafs login succeeded\n");
 
   if (cookielist) {
@@ -480,79 +690,57 @@ int klafs_login() {
 	 extractTokenFromCookie(cookielist->data);
   }
 
-  free(response->memory);
-  free(response);
     
   return KLAFS_OK;
 }
 
 bool is_scene_configured(int scene) {
-  char scene_str[5];
+  char scene_str[16];
   sprintf(scene_str, "-%d-", scene);
-  if (strstr(klafs.sauna.configured_scenes, scene_str) != NULL) {
-    return TRUE;
-  } else return FALSE;
+  pthread_mutex_lock(&g_network_mutex);
+  bool configured = klafs.sauna.configured_scenes != NULL && strstr(klafs.sauna.configured_scenes, scene_str) != NULL;
+  pthread_mutex_unlock(&g_network_mutex);
+  return configured;
 }
 
+/* copy of the scene in the arena of the current cycle */
 scene_t* get_scene_configuration(int scene) {
   scene_t *scene_data;
-  int v;
   
-  scene_data = malloc(sizeof(scene_t));
+  scene_data = arena_alloc(sizeof(scene_t));
   if (!scene_data) {
     return NULL;
   }
   memset(scene_data, 0, sizeof(scene_t));
   
-  v = 0;
-  while (1) {
-    if (&klafs.sauna.scenes[v] != NULL) {
-      if (klafs.sauna.scenes[v].dsId == scene) {
-        scene_data->isPoweredOn = klafs.sauna.scenes[v].isPoweredOn;
-        scene_data->saunaSelected = klafs.sauna.scenes[v].saunaSelected;
-        scene_data->sanariumSelected = klafs.sauna.scenes[v].sanariumSelected;
-        scene_data->irSelected = klafs.sauna.scenes[v].irSelected;
-        scene_data->selectedSaunaTemperature = klafs.sauna.scenes[v].selectedSaunaTemperature;
-        scene_data->selectedSanariumTemperature = klafs.sauna.scenes[v].selectedSanariumTemperature;
-        scene_data->selectedIrTemperature = klafs.sauna.scenes[v].selectedIrTemperature;
-        scene_data->selectedHumLevel = klafs.sauna.scenes[v].selectedHumLevel;
-        scene_data->selectedIrLevel = klafs.sauna.scenes[v].selectedIrLevel;
-        scene_data->selectedHour = klafs.sauna.scenes[v].selectedHour;
-        scene_data->selectedMinute = klafs.sauna.scenes[v].selectedMinute;
-        scene_data->selectedHour = klafs.sauna.scenes[v].selectedHour;
-        scene_data->selectedMinute = klafs.sauna.scenes[v].selectedMinute;
-        scene_data->bathingHours = klafs.sauna.scenes[v].bathingHours;
-        scene_data->bathingMinutes = klafs.sauna.scenes[v].bathingMinutes;
-        break;
-      }
-      
-      v++;
-    } else {
+  pthread_mutex_lock(&g_network_mutex);
+  for (int v = 0; v < klafs.sauna.scene_count; v++) {
+    if (klafs.sauna.scenes[v].dsId == scene) {
+      memcpy(scene_data, &klafs.sauna.scenes[v], sizeof(scene_t));
       break;
     }
   }
+  pthread_mutex_unlock(&g_network_mutex);
     
   return scene_data;
 }
 
+static int klafs_scene_temperature(scene_t *scene_data) {
+  if (scene_data->sanariumSelected) return scene_data->selectedSanariumTemperature;
+  if (scene_data->irSelected) return scene_data->selectedIrTemperature;
+  return scene_data->selectedSaunaTemperature;
+}
+
 int klafs_change_temperature(scene_t *scene_data) {
   struct memory_struct *response = NULL;
 
-  json_object *json1; 
-
-  json_object *jstring_saunaid = json_object_new_string(klafs.sauna.id);
-  json_object *jstring_true = json_object_new_string("true");
-  json_object *jstring_false = json_object_new_string("false");
-    
-  json1 = json_object_new_object();
-
-  json_object_object_add(json1,"id", jstring_saunaid);
-  json_object_object_add(json1,"temperature", json_object_new_int(scene_data->selectedSaunaTemperature));
-  
-  response = http_post_get(true, url_changeTemperature, NULL, json1, klafs.aspxauth);
+  klafs_request_params_t params = { .id = klafs.sauna.id, .temperature = klafs_scene_temperature(scene_data) };
+  const char *request_body = klafs_render_request(KLAFS_REQUEST_CHANGE_TEMPERATURE, &params);
+  if (request_body == NULL) {
+    return KLAFS_CONFIGCHANGE_FAILED;
+  }
   
-  //free mem
-  json_object_put(json1);
+  response = http_post_get(true, url_changeTemperature, NULL, request_body, klafs.aspxauth);
   
   if (response == NULL) {
     vdc_report(LOG_ERR, "Klafs config change failed\n");
@@ -564,27 +752,19 @@ int klafs_change_temperature(scene_t *scene_data) {
     return -1;
   }
   
-  free(response->memory);
-  free(response);
-  
+  return KLAFS_OK;
 }
 
 int klafs_change_humidity(scene_t *scene_data) {
   struct memory_struct *response = NULL;
 
-  json_object *json1; 
-
-  json_object *jstring_saunaid = json_object_new_string(klafs.sauna.id);
-    
-  json1 = json_object_new_object();
-
-  json_object_object_add(json1,"id", jstring_saunaid);
-  json_object_object_add(json1,"level", json_object_new_int(scene_data->selectedHumLevel));
-  
-  response = http_post_get(true, url_changeHumidity, NULL, json1, klafs.aspxauth);
+  klafs_request_params_t params = { .id = klafs.sauna.id, .hum_level = scene_data->selectedHumLevel };
+  const char *request_body = klafs_render_request(KLAFS_REQUEST_CHANGE_HUMIDITY, &params);
+  if (request_body == NULL) {
+    return KLAFS_CONFIGCHANGE_FAILED;
+  }
   
-  //free mem
-  json_object_put(json1);
+  response = http_post_get(true, url_changeHumidity, NULL, request_body, klafs.aspxauth);
   
   if (response == NULL) {
     vdc_report(LOG_ERR, "Klafs config change failed\n");
@@ -596,32 +776,28 @@ int klafs_change_humidity(scene_t *scene_data) {
     return -1;
   }
   
-  free(response->memory);
-  free(response);
-  
+  return KLAFS_OK;
 }
 
 int klafs_change_mode(scene_t *scene_data) {
   struct memory_struct *response = NULL;
 
-  json_object *json1; 
-  
-  json_object *jstring_saunaid = json_object_new_string(klafs.sauna.id);
-  json_object *jstring_true = json_object_new_string("true");
-  json_object *jstring_false = json_object_new_string("false");
- 
-  json1 = json_object_new_object();
+  klafs_request_params_t params = { .id = klafs.sauna.id };
 
-  json_object_object_add(json1,"id", jstring_saunaid);
+  if (scene_data->saunaSelected) params.mode = 1;
+    else if (scene_data->sanariumSelected) params.mode = 2;
+    else if (scene_data->irSelected) params.mode = 3;
+    else {
+      vdc_report(LOG_DEBUG, "network: no mode selected, mode not changed\n");
+      return KLAFS_OK;
+    }
 
-  if (scene_data->saunaSelected) json_object_object_add(json1, "selected_mode", json_object_new_int(1));
-    else if (scene_data->sanariumSelected) json_object_object_add(json1, "selected_mode", json_object_new_int(2));
-    else if (scene_data->irSelected) json_object_object_add(json1, "selected_mode", json_object_new_int(3));
-  
-  response = http_post_get(true, url_changeMode, NULL, json1, klafs.aspxauth);
+  const char *request_body = klafs_render_request(KLAFS_REQUEST_SET_MODE, &params);
+  if (request_body == NULL) {
+    return KLAFS_CONFIGCHANGE_FAILED;
+  }
   
-  //free mem
-  json_object_put(json1);
+  response = http_post_get(true, url_changeMode, NULL, request_body, klafs.aspxauth);
   
   if (response == NULL) {
     vdc_report(LOG_ERR, "Klafs config change failed\n");
@@ -633,57 +809,32 @@ int klafs_change_mode(scene_t *scene_data) {
     return -1;
   }
   
-  free(response->memory);
-  free(response);  
+
+  return KLAFS_OK;
 }
   
 int klafs_change_favoriteprogram(scene_t *scene_data) {
   struct memory_struct *response = NULL;
 
-  json_object *json1; 
-
-  json_object *jstring_saunaid = json_object_new_string(klafs.sauna.id);
-  json_object *jstring_true = json_object_new_string("true");
-  json_object *jstring_false = json_object_new_string("false");
-    
-  json1 = json_object_new_object();
-  
-  json_object_object_add(json1,"id", jstring_saunaid);
+  klafs_request_params_t params = { .id = klafs.sauna.id };
   
   //TODO call setmode
   klafs_change_mode(scene_data);
   
-  if (scene_data->saunaSelected) json_object_object_add(json1,"temp", json_object_new_int(scene_data->selectedSaunaTemperature));
-    else if (scene_data->sanariumSelected) json_object_object_add(json1,"temp", json_object_new_int(scene_data->selectedSanariumTemperature));
-    else if (scene_data->irSelected) json_object_object_add(json1,"temp", json_object_new_int(scene_data->selectedIrTemperature));
-  
-  json_object_object_add(json1,"hum_level", json_object_new_int(scene_data->selectedHumLevel));
-  json_object_object_add(json1,"ir_level", json_object_new_int(scene_data->selectedIrLevel));
-  //json_object_object_add(json2,"showBathingHour", json_object_new_int(scene_data->showBathingHour));
-  //json_object_object_add(json2,"bathingHours", json_object_new_int(scene_data->bathingHours));
-  //json_object_object_add(json2,"bathingMinutes", json_object_new_int(scene_data->bathingMinutes));
-  time_t rawtime;
-  struct tm * timeinfo;
-
-  time ( &rawtime );
-  timeinfo = localtime ( &rawtime );
-
-//  if (scene_data->selectedHour > -1) {
-  //  json_object_object_add(json2,"selectedHour", json_object_new_int(scene_data->selectedHour));
-//  } else {
-  //  json_object_object_add(json2,"selectedHour", json_object_new_int(timeinfo->tm_hour));
-//  }
-  //if (scene_data->selectedMinute > -1) {
-    //json_object_object_add(json2,"selectedMinute", json_object_new_int(scene_data->selectedMinute));
-//  } else {
-  //  json_object_object_add(json2,"selectedMinute", json_object_new_int(timeinfo->tm_min+5));
-  //}
+  if (scene_data->saunaSelected) params.temperature = scene_data->selectedSaunaTemperature;
+    else if (scene_data->sanariumSelected) params.temperature = scene_data->selectedSanariumTemperature;
+    else if (scene_data->irSelected) params.temperature = scene_data->selectedIrTemperature;
   
-   
-  response = http_post_get(true, url_changeFavoriteProgram, NULL, json1, klafs.aspxauth);
-  
-  //free mem
-  json_object_put(json1);
+  params.hum_level = scene_data->selectedHumLevel;
+  params.ir_level = scene_data->selectedIrLevel;
+  /* the start time of timed scenes is handled by schedule_start() */
+
+  const char *request_body = klafs_render_request(KLAFS_REQUEST_FAVORITE_SELECTED, &params);
+  if (request_body == NULL) {
+    return KLAFS_CONFIGCHANGE_FAILED;
+  }
+
+  response = http_post_get(true, url_changeFavoriteProgram, NULL, request_body, klafs.aspxauth);
   
   if (response == NULL) {
     vdc_report(LOG_ERR, "Klafs config change failed\n");
@@ -695,31 +846,32 @@ int klafs_change_favoriteprogram(scene_t *scene_data) {
     return -1;
   }
   
-  free(response->memory);
-  free(response);
+
+  return KLAFS_OK;
 }
 
 int klafs_power_on() {
-  vdc_report(LOG_NOTICE, "network: Power on sauna\n");
+  return klafs_power_on_at(-1, -1);
+}
+
+/* with a start time (hour >= 0) the klafs server starts the sauna itself at hour:minute */
+int klafs_power_on_at(int hour, int minute) {
+  bool timed = hour >= 0 && minute >= 0;
+  if (timed) {
+    vdc_report(LOG_NOTICE, "network: Power on sauna at %02d:%02d\n", hour, minute);
+  } else {
+    vdc_report(LOG_NOTICE, "network: Power on sauna\n");
+  }
   
   struct memory_struct *response = NULL;
   
-  json_object *json1; 
-
-  json_object *jstring_saunaid = json_object_new_string(klafs.sauna.id);
-  json_object *jstring_klafspin = json_object_new_string(klafs.pin);
-  json_object *jstring_true = json_object_new_string("true");
-  json_object *jstring_false = json_object_new_string("false");
-    
-  json1 = json_object_new_object();
-  
-  json_object_object_add(json1,"id", jstring_saunaid);
-  json_object_object_add(json1,"pin", jstring_klafspin);
-  json_object_object_add(json1,"time_selected", jstring_false);
-  json_object_object_add(json1,"sel_hour", json_object_new_int(0));
-  json_object_object_add(json1,"sel_min", json_object_new_int(0));
+  klafs_request_params_t params = { .id = klafs.sauna.id, .pin = klafs.pin, .time_selected = timed, .sel_hour = timed ? hour : 0, .sel_min = timed ? minute : 0 };
+  const char *request_body = klafs_render_request(KLAFS_REQUEST_START_CABIN, &params);
+  if (request_body == NULL) {
+    return KLAFS_CONNECT_FAILED;
+  }
   
-  response = http_post_get(true, url_startcabin, NULL, json1, klafs.aspxauth);
+  response = http_post_get(true, url_startcabin, NULL, request_body, klafs.aspxauth);
 
   if (response == NULL) {
     vdc_report(LOG_ERR, "network: power on sauna failed\n");
@@ -731,12 +883,11 @@ int klafs_power_on() {
     return -1;
   }
   
-  free(response->memory);
-  free(response);
-  
-  //get latest sauna values and do a immediate push to DSS; in case power on failed, e.g. security check not done in sauna, isPoweredOn stays "false"
-  klafs_get_values();
-  push_binary_input_states();   
+  //assume the sauna is powered on now and do a immediate push to DSS; the next poll corrects it, e.g. if the security check was not done in sauna
+  if (!timed) {
+    klafs_apply_power_state(true);
+    push_request(PUSH_BINARY_INPUT_STATES);   
+  }
   
   return 0;
 }
@@ -744,9 +895,11 @@ int klafs_power_on() {
 int klafs_power_off() {
   vdc_report(LOG_NOTICE, "network: Power off sauna\n");
 
-  char request_body[1024];
-  strcpy(request_body, "id=");
-  strcat(request_body, klafs.sauna.id);
+  klafs_request_params_t params = { .id = klafs.sauna.id };
+  const char *request_body = klafs_render_request(KLAFS_REQUEST_STOP_CABIN, &params);
+  if (request_body == NULL) {
+    return KLAFS_CONNECT_FAILED;
+  }
   
   struct memory_struct *response = http_post_get(true, url_stopcabin, request_body, NULL, klafs.aspxauth);
   
@@ -755,26 +908,74 @@ int klafs_power_off() {
     return KLAFS_CONNECT_FAILED;
   }
   
-  free(response->memory);
-  free(response);
-  
-  //get latest sauna values and do a immediate push to DSS
-  klafs_get_values();
-  push_binary_input_states();
+  //assume the sauna is powered off now and do a immediate push to DSS; the next poll corrects it if needed
+  klafs_apply_power_state(false);
+  push_request(PUSH_BINARY_INPUT_STATES);
   
   return 0;
 }
 
-int klafs_get_values() {
+/* 64 bit FNV-1a hash of the raw GetData body, identical bodies need no parsing;
+ * guarded by g_network_mutex. g_values_tables counts the reloads of the value
+ * tables, a parse which overlapped one does not validate the hash.
+ */
+static uint64_t g_values_hash = 0;
+static bool g_values_hash_valid = false;
+static unsigned long g_values_tables = 0;
+
+/* the value tables were replaced, the next GetData response is parsed in full */
+void klafs_values_invalidate() {
+  pthread_mutex_lock(&g_network_mutex);
+  g_values_hash_valid = false;
+  g_values_tables++;
+  pthread_mutex_unlock(&g_network_mutex);
+}
+
+static uint64_t hash_fnv1a(const char *data, size_t size) {
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (size_t i = 0; i < size; i++) {
+    hash ^= (unsigned char) data[i];
+    hash *= 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+/* the sauna values did not change: only renew the query time of the polled values;
+ * returns true if the heat-up prediction changed
+ */
+static bool klafs_refresh_values(time_t now) {
+  pthread_mutex_lock(&g_network_mutex);
+  for (int i = 0; i < klafs.sauna.sensor_count; i++) {
+    sensor_value_t *svalue = &klafs.sauna.sensor_values[i];
+    if (svalue->polled) {
+      svalue->last_query = now;
+      sensor_history_record(svalue, now);
+    }
+  }
+  for (int i = 0; i < klafs.sauna.binary_count; i++) {
+    binary_value_t *bvalue = &klafs.sauna.binary_values[i];
+    if (bvalue->polled) {
+      bvalue->last_query = now;
+    }
+  }
+  bool changed = heatup_update(sauna_current_values, now);
+  pthread_mutex_unlock(&g_network_mutex);
+
+  return changed;
+}
+
+static int klafs_fetch_values() {
   int rc;
   
   vdc_report(LOG_NOTICE, "network: reading Klafs Sauna values\n");
 
-  char request_body[strlen(klafs.sauna.id)+4];
-  strcpy(request_body, "?id=");
-  strcat(request_body, klafs.sauna.id);
-  
+  klafs_request_params_t params = { .id = klafs.sauna.id };
+  const char *request_body = klafs_render_request(KLAFS_REQUEST_GETDATA, &params);
+  if (request_body == NULL) {
+    return KLAFS_GETMEASURE_FAILED;
+  }
   
+  uint64_t requested_ms = timer_now_ms();
   struct memory_struct *response = http_post_get(false, url_getsaunastatus, request_body, NULL, klafs.aspxauth);
   
   if (response == NULL) {
@@ -782,11 +983,233 @@ int klafs_get_values() {
     return KLAFS_CONNECT_FAILED;
   }
   
-  rc = parse_json_data(response);
-  
-  free(response->memory);
-  free(response);
+  uint64_t hash = hash_fnv1a(response->memory, response->size);
+  g_stats.polls++;
+
+  // pending optimistic updates must be reconciled by a full parse
+  pthread_mutex_lock(&g_network_mutex);
+  bool unchanged = g_values_hash_valid && hash == g_values_hash && g_expected_count == 0;
+  unsigned long tables = g_values_tables;
+  pthread_mutex_unlock(&g_network_mutex);
+
+  if (unchanged) {
+    g_stats.polls_unchanged++;
+    vdc_report(LOG_DEBUG, "network: klafs sauna values response unchanged (%zu bytes)\n", response->size);
+    rc = klafs_refresh_values(time(NULL)) ? 0 : 1;
+  } else {
+    uint64_t parse_start = trace_now_us();
+    rc = parse_json_data(response->memory, response->size, requested_ms);
+    trace_span("parse", "parse", parse_start, trace_now_us(), NULL);
+    pthread_mutex_lock(&g_network_mutex);
+    g_values_hash = hash;
+    g_values_hash_valid = (rc >= 0) && tables == g_values_tables;
+    pthread_mutex_unlock(&g_network_mutex);
+  }
   
   return rc;  
 }
 
+/* single flight for GetData: concurrent callers share one outstanding request and its
+ * result, a successful result younger than g_values_max_age seconds is returned without request
+ */
+static pthread_mutex_t g_values_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_values_cond = PTHREAD_COND_INITIALIZER;
+static bool g_values_in_flight = false;
+static unsigned long g_values_generation = 0;
+static int g_values_rc;
+static bool g_values_valid = false;
+static struct timespec g_values_time;
+
+int klafs_get_values() {
+  int rc;
+  struct timespec now;
+
+  pthread_mutex_lock(&g_values_mutex);
+
+  if (g_values_in_flight) {
+    unsigned long generation = g_values_generation;
+    uint64_t wait_start = trace_now_us();
+    vdc_report(LOG_DEBUG, "network: waiting for sauna values request in flight\n");
+    while (g_values_in_flight && generation == g_values_generation) {
+      pthread_cond_wait(&g_values_cond, &g_values_mutex);
+    }
+    rc = g_values_rc;
+    pthread_mutex_unlock(&g_values_mutex);
+    trace_span("values in flight", "queue", wait_start, trace_now_us(), NULL);
+    return rc;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  if (g_values_valid && now.tv_sec - g_values_time.tv_sec < g_values_max_age) {
+    rc = g_values_rc;
+    pthread_mutex_unlock(&g_values_mutex);
+    vdc_report(LOG_DEBUG, "network: sauna values of %ld seconds ago are recent enough\n", now.tv_sec - g_values_time.tv_sec);
+    return rc;
+  }
+
+  g_values_in_flight = true;
+  pthread_mutex_unlock(&g_values_mutex);
+
+  rc = klafs_fetch_values();
+
+  pthread_mutex_lock(&g_values_mutex);
+  clock_gettime(CLOCK_MONOTONIC, &g_values_time);
+  g_values_rc = rc;
+  g_values_valid = (rc >= 0);
+  g_values_generation++;
+  g_values_in_flight = false;
+  pthread_cond_broadcast(&g_values_cond);
+  pthread_mutex_unlock(&g_values_mutex);
+
+  return rc;
+}
+
+/* single PostConfigChange request; returns KLAFS_OK only for a 2xx response with
+ * a JSON object not reporting a failure, KLAFS_CONFIGCHANGE_UNSUPPORTED if the
+ * klafs server does not know the endpoint and KLAFS_CONFIGCHANGE_FAILED for any
+ * other result, e.g. a 400 for a value out of range
+ */
+static int klafs_post_config_change(scene_t *target) {
+  klafs_request_params_t params = { .id = klafs.sauna.id,
+      .sauna_selected = target->saunaSelected, .sanarium_selected = target->sanariumSelected, .ir_selected = target->irSelected,
+      .sauna_temperature = target->selectedSaunaTemperature, .sanarium_temperature = target->selectedSanariumTemperature,
+      .ir_temperature = target->selectedIrTemperature, .hum_level = target->selectedHumLevel, .ir_level = target->selectedIrLevel };
+  const char *request_body = klafs_render_request(KLAFS_REQUEST_POST_CONFIG_CHANGE, &params);
+  if (request_body == NULL) {
+    return KLAFS_CONFIGCHANGE_FAILED;
+  }
+
+  struct memory_struct *response = http_post_get(true, url_postconfigchange, NULL, request_body, klafs.aspxauth);
+
+  if (g_response_code == 404 || g_response_code == 405 || g_response_code == 501) {
+    return KLAFS_CONFIGCHANGE_UNSUPPORTED;
+  }
+
+  if (response == NULL || g_response_code < 200 || g_response_code > 299) {
+    vdc_report(LOG_ERR, "network: PostConfigChange failed (%ld)\n", g_response_code);
+    return KLAFS_CONFIGCHANGE_FAILED;
+  }
+
+  // a login or security check page after a redirect is no JSON object
+  scan_member_t *members;
+  int count = scan_object(response->memory, response->size, &members);
+  if (count < 0) {
+    vdc_report(LOG_ERR, "network: PostConfigChange returned no JSON object\n");
+    vdc_report(LOG_DEBUG, "%s\n", response->memory);
+    return KLAFS_CONFIGCHANGE_FAILED;
+  }
+  for (int m = 0; m < count; m++) {
+    if (members[m].type != SCAN_BOOL) {
+      continue;
+    }
+    if ((strcasecmp(members[m].key, "success") == 0 && !members[m].boolean) || (strcasecmp(members[m].key, "LoginRequired") == 0 && members[m].boolean)) {
+      vdc_report(LOG_ERR, "network: PostConfigChange rejected (%s: %s)\n", members[m].key, members[m].boolean ? "true" : "false");
+      return KLAFS_CONFIGCHANGE_FAILED;
+    }
+  }
+
+  return KLAFS_OK;
+}
+
+/* the individual SaunaApp endpoints, one request per changed part */
+static int klafs_change_configuration_single(scene_t *target, unsigned int changes) {
+  int rc = KLAFS_OK;
+
+  if (changes & KLAFS_CHANGE_IR_LEVEL) {
+    // FavoriteSelected is the only endpoint taking the IR level and sets temperature and humidity as well
+    return klafs_change_favoriteprogram(target);
+  }
+
+  if (changes & KLAFS_CHANGE_MODE) {
+    rc = klafs_change_mode(target);
+  }
+  if (rc == KLAFS_OK && (changes & KLAFS_CHANGE_TEMPERATURE)) {
+    rc = klafs_change_temperature(target);
+  }
+  if (rc == KLAFS_OK && (changes & KLAFS_CHANGE_HUMIDITY)) {
+    rc = klafs_change_humidity(target);
+  }
+
+  return rc;
+}
+
+/* the merged configuration was applied: later partial changes within
+ * g_values_max_age merge with it instead of the values of the last poll
+ */
+static void klafs_apply_configuration(const scene_t *target) {
+  pthread_mutex_lock(&g_network_mutex);
+  sauna_current_values->saunaSelected = target->saunaSelected;
+  sauna_current_values->sanariumSelected = target->sanariumSelected;
+  sauna_current_values->irSelected = target->irSelected;
+  sauna_current_values->selectedSaunaTemperature = target->selectedSaunaTemperature;
+  sauna_current_values->selectedSanariumTemperature = target->selectedSanariumTemperature;
+  sauna_current_values->selectedIrTemperature = target->selectedIrTemperature;
+  sauna_current_values->selectedHumLevel = target->selectedHumLevel;
+  sauna_current_values->selectedIrLevel = target->selectedIrLevel;
+  pthread_mutex_unlock(&g_network_mutex);
+}
+
+/* set from dSS callbacks on the main thread and scheduled starts on the network thread */
+static pthread_mutex_t g_postconfigchange_mutex = PTHREAD_MUTEX_INITIALIZER;
+static bool g_postconfigchange_supported = true;
+
+/* changes mode, temperature, humidity and/or IR level of the sauna with as few
+ * requests as possible; parts not selected by changes keep the values of the
+ * last poll, which is repeated if it is older than g_values_max_age seconds
+ * (polls are skipped for up to 30 minutes while the sauna heats up)
+ */
+int klafs_change_configuration(scene_t *scene_data, unsigned int changes) {
+  scene_t target;
+  int rc = KLAFS_CONFIGCHANGE_UNSUPPORTED;
+
+  if ((changes & KLAFS_CHANGE_ALL) != KLAFS_CHANGE_ALL && klafs_get_values() < 0) {
+    vdc_report(LOG_ERR, "network: no current sauna values to merge the change with\n");
+    return KLAFS_CONFIGCHANGE_FAILED;
+  }
+
+  trace_lock(&g_network_mutex, "network lock");
+  memcpy(&target, sauna_current_values, sizeof(scene_t));
+  pthread_mutex_unlock(&g_network_mutex);
+
+  if (changes & KLAFS_CHANGE_MODE) {
+    target.saunaSelected = scene_data->saunaSelected;
+    target.sanariumSelected = scene_data->sanariumSelected;
+    target.irSelected = scene_data->irSelected;
+  }
+  if (changes & KLAFS_CHANGE_TEMPERATURE) {
+    // only the temperature of the (new) mode is taken from the scene
+    if (target.sanariumSelected) target.selectedSanariumTemperature = scene_data->selectedSanariumTemperature;
+      else if (target.irSelected) target.selectedIrTemperature = scene_data->selectedIrTemperature;
+      else target.selectedSaunaTemperature = scene_data->selectedSaunaTemperature;
+  }
+  if (changes & KLAFS_CHANGE_HUMIDITY) {
+    target.selectedHumLevel = scene_data->selectedHumLevel;
+  }
+  if (changes & KLAFS_CHANGE_IR_LEVEL) {
+    target.selectedIrLevel = scene_data->selectedIrLevel;
+  }
+
+  pthread_mutex_lock(&g_postconfigchange_mutex);
+  bool supported = g_postconfigchange_supported;
+  pthread_mutex_unlock(&g_postconfigchange_mutex);
+
+  if (supported) {
+    rc = klafs_post_config_change(&target);
+    if (rc == KLAFS_CONFIGCHANGE_UNSUPPORTED) {
+      pthread_mutex_lock(&g_postconfigchange_mutex);
+      g_postconfigchange_supported = false;
+      pthread_mutex_unlock(&g_postconfigchange_mutex);
+      vdc_report(LOG_NOTICE, "network: klafs server does not support PostConfigChange (%ld), using single requests\n", g_response_code);
+    } else if (rc != KLAFS_OK) {
+      vdc_report(LOG_NOTICE, "network: PostConfigChange not confirmed, using single requests\n");
+    }
+  }
+  if (rc != KLAFS_OK) {
+    rc = klafs_change_configuration_single(&target, changes);
+  }
+
+  if (rc == KLAFS_OK) {
+    klafs_apply_configuration(&target);
+  }
+  return rc;
+}
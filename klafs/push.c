@@ -0,0 +1,190 @@
+/*
+ Author: Alexander Knauer <a-x-e@gmx.net>
+ License: Apache 2.0
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <digitalSTROM/dsuid.h>
+#include <dsvdc/dsvdc.h>
+
+#include "klafs.h"
+
+/* pushes to dSS: callers only mark which state groups changed, the main loop
+ * sends all marked groups in one envelope once the coalescing window of the
+ * first request has passed, so e.g. a command result and the following poll
+ * result reach dSS in a single message
+ */
+
+static pthread_mutex_t g_push_mutex = PTHREAD_MUTEX_INITIALIZER;
+static unsigned int g_push_pending = 0;
+static struct timespec g_push_since;
+static unsigned long g_push_trace = 0;
+static uint64_t g_push_trace_since = 0;
+
+void push_request(unsigned int groups) {
+  pthread_mutex_lock(&g_push_mutex);
+  if (g_push_pending == 0) {
+    clock_gettime(CLOCK_MONOTONIC, &g_push_since);
+  }
+  g_push_pending |= groups;
+  g_stats.push_requests++;
+  /* the push is traced as part of the first traced request */
+  if (g_push_trace == 0 && trace_current() != 0) {
+    g_push_trace = trace_current();
+    g_push_trace_since = trace_now_us();
+  }
+  pthread_mutex_unlock(&g_push_mutex);
+}
+
+bool push_pending() {
+  pthread_mutex_lock(&g_push_mutex);
+  bool pending = g_push_pending != 0;
+  pthread_mutex_unlock(&g_push_mutex);
+  return pending;
+}
+
+static void push_add_sensor_states(dsvdc_property_t *envelope, time_t now) {
+  dsvdc_property_t *propState;
+  if (dsvdc_property_new(&propState) != DSVDC_OK) {
+    vdc_report(LOG_ERR, "create new property failed!");
+    return;
+  }
+
+  for (int i = 0; i < sauna_device->sauna->sensor_count; i++) {
+    sensor_value_t *value = &sauna_device->sauna->sensor_values[i];
+    dsvdc_property_t *prop;
+    if (dsvdc_property_new(&prop) != DSVDC_OK) {
+      vdc_report(LOG_ERR, "create new property failed!");
+      break;
+    }
+    dsvdc_property_add_double(prop, "value", value->value);
+    dsvdc_property_add_int(prop, "age", now - value->last_query);
+    dsvdc_property_add_int(prop, "error", 0);
+
+    char sensorIndex[16];
+    snprintf(sensorIndex, sizeof(sensorIndex), "%d", i);
+    dsvdc_property_add_property(propState, sensorIndex, &prop);
+
+    value->last_reported = now;
+  }
+
+  dsvdc_property_add_property(envelope, "sensorStates", &propState);
+}
+
+static void push_add_binary_input_states(dsvdc_property_t *envelope, time_t now) {
+  dsvdc_property_t *propState;
+  if (dsvdc_property_new(&propState) != DSVDC_OK) {
+    vdc_report(LOG_ERR, "create new property failed!");
+    return;
+  }
+
+  for (int i = 0; i < sauna_device->sauna->binary_count; i++) {
+    binary_value_t *value = &sauna_device->sauna->binary_values[i];
+    dsvdc_property_t *prop;
+    if (dsvdc_property_new(&prop) != DSVDC_OK) {
+      vdc_report(LOG_ERR, "create new property failed!");
+      break;
+    }
+    dsvdc_property_add_bool(prop, "value", value->value);
+    dsvdc_property_add_int(prop, "age", now - value->last_query);
+    dsvdc_property_add_int(prop, "error", 0);
+
+    char sensorIndex[16];
+    snprintf(sensorIndex, sizeof(sensorIndex), "%d", i);
+    dsvdc_property_add_property(propState, sensorIndex, &prop);
+
+    value->last_reported = now;
+  }
+
+  dsvdc_property_add_property(envelope, "binaryInputStates", &propState);
+}
+
+static void push_add_device_states(dsvdc_property_t *envelope) {
+  dsvdc_property_t *propDevState;
+  dsvdc_property_t *prop;
+  if (dsvdc_property_new(&propDevState) != DSVDC_OK) {
+    vdc_report(LOG_ERR, "create new property failed!");
+    return;
+  }
+  if (dsvdc_property_new(&prop) != DSVDC_OK) {
+    vdc_report(LOG_ERR, "create new property failed!");
+    dsvdc_property_free(propDevState);
+    return;
+  }
+  dsvdc_property_add_string(prop, "name", "SaunaConnected");
+  dsvdc_property_add_string(prop, "value", "1");
+  dsvdc_property_add_property(propDevState, 0, &prop);
+
+  dsvdc_property_add_property(envelope, "deviceStates", &propDevState);
+}
+
+/* the push message for the given state groups, NULL if out of memory */
+dsvdc_property_t* push_build_envelope(unsigned int groups, time_t now) {
+  dsvdc_property_t *envelope;
+  if (dsvdc_property_new(&envelope) != DSVDC_OK) {
+    vdc_report(LOG_ERR, "create new property failed!");
+    return NULL;
+  }
+
+  if (groups & PUSH_SENSOR_STATES) {
+    push_add_sensor_states(envelope, now);
+  }
+  if (groups & PUSH_BINARY_INPUT_STATES) {
+    push_add_binary_input_states(envelope, now);
+  }
+  if (groups & PUSH_DEVICE_STATES) {
+    push_add_device_states(envelope);
+  }
+  return envelope;
+}
+
+/* sends the pending groups if the coalescing window has passed or force is set;
+ * must be called with g_network_mutex held
+ */
+void push_flush(bool force) {
+  struct timespec now;
+
+  pthread_mutex_lock(&g_push_mutex);
+  unsigned int groups = g_push_pending;
+  if (groups == 0) {
+    pthread_mutex_unlock(&g_push_mutex);
+    return;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  long waited = (now.tv_sec - g_push_since.tv_sec) * 1000 + (now.tv_nsec - g_push_since.tv_nsec) / 1000000;
+  if (!force && waited < g_push_coalesce) {
+    pthread_mutex_unlock(&g_push_mutex);
+    return;
+  }
+  g_push_pending = 0;
+  unsigned long trace = g_push_trace;
+  uint64_t trace_since = g_push_trace_since;
+  g_push_trace = 0;
+  pthread_mutex_unlock(&g_push_mutex);
+
+  unsigned long previous_trace = trace_current();
+  trace_set(trace);
+  uint64_t push_start = trace_now_us();
+  trace_span("push queued", "queue", trace_since, push_start, NULL);
+
+  dsvdc_property_t *envelope = push_build_envelope(groups, time(NULL));
+  if (envelope == NULL) {
+    trace_set(previous_trace);
+    return;
+  }
+
+  vdc_report(LOG_DEBUG, "push: sending groups 0x%x after %ld ms\n", groups, waited);
+  dsvdc_push_property(handle, sauna_device->dsuidstring, envelope);
+  dsvdc_property_free(envelope);
+  g_stats.pushes++;
+  trace_span("push", "push", push_start, trace_now_us(), NULL);
+  trace_set(previous_trace);
+}
@@ -0,0 +1,239 @@
+/*
+ Author: Alexander Knauer <a-x-e@gmx.net>
+ License: Apache 2.0
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#include <digitalSTROM/dsuid.h>
+#include <dsvdc/dsvdc.h>
+
+#include "klafs.h"
+
+/* request bodies for the Klafs API are rendered from templates into the
+ * arena of the current cycle (arena.c), so a body is valid until the poll or
+ * command that rendered it ends; "{name}" refers to a member of
+ * klafs_request_params_t and is escaped according to the template encoding.
+ * The templates are compiled once into a list of literal and parameter
+ * segments, rendering takes at most KLAFS_REQUEST_BUFSIZE bytes and gives
+ * back what the body does not use.
+ */
+
+#define REQUEST_MAX_SEGMENTS 24
+
+typedef enum {
+  ENCODING_JSON,
+  ENCODING_FORM
+} request_encoding_t;
+
+typedef enum {
+  PARAM_STRING,
+  PARAM_INT,
+  PARAM_BOOL
+} request_param_type_t;
+
+typedef struct request_param {
+  const char *name;
+  request_param_type_t type;
+  size_t offset;
+} request_param_t;
+
+typedef struct request_segment {
+  const char *literal;
+  size_t length;
+  const request_param_t *param;
+} request_segment_t;
+
+typedef struct request_template {
+  request_encoding_t encoding;
+  const char *source;
+  request_segment_t segments[REQUEST_MAX_SEGMENTS];
+  int count;
+} request_template_t;
+
+static const request_param_t g_request_params[] = {
+  { "id", PARAM_STRING, offsetof(klafs_request_params_t, id) },
+  { "pin", PARAM_STRING, offsetof(klafs_request_params_t, pin) },
+  { "username", PARAM_STRING, offsetof(klafs_request_params_t, username) },
+  { "password", PARAM_STRING, offsetof(klafs_request_params_t, password) },
+  { "temperature", PARAM_INT, offsetof(klafs_request_params_t, temperature) },
+  { "sauna_selected", PARAM_BOOL, offsetof(klafs_request_params_t, sauna_selected) },
+  { "sanarium_selected", PARAM_BOOL, offsetof(klafs_request_params_t, sanarium_selected) },
+  { "ir_selected", PARAM_BOOL, offsetof(klafs_request_params_t, ir_selected) },
+  { "sauna_temperature", PARAM_INT, offsetof(klafs_request_params_t, sauna_temperature) },
+  { "sanarium_temperature", PARAM_INT, offsetof(klafs_request_params_t, sanarium_temperature) },
+  { "ir_temperature", PARAM_INT, offsetof(klafs_request_params_t, ir_temperature) },
+  { "hum_level", PARAM_INT, offsetof(klafs_request_params_t, hum_level) },
+  { "ir_level", PARAM_INT, offsetof(klafs_request_params_t, ir_level) },
+  { "mode", PARAM_INT, offsetof(klafs_request_params_t, mode) },
+  { "time_selected", PARAM_BOOL, offsetof(klafs_request_params_t, time_selected) },
+  { "sel_hour", PARAM_INT, offsetof(klafs_request_params_t, sel_hour) },
+  { "sel_min", PARAM_INT, offsetof(klafs_request_params_t, sel_min) },
+};
+
+static request_template_t g_request_templates[] = {
+  [KLAFS_REQUEST_LOGIN] = { ENCODING_FORM, "UserName={username}&Password={password}" },
+  [KLAFS_REQUEST_GETDATA] = { ENCODING_FORM, "?id={id}" },
+  [KLAFS_REQUEST_START_CABIN] = { ENCODING_JSON, "{\"id\":\"{id}\",\"pin\":\"{pin}\",\"time_selected\":\"{time_selected}\",\"sel_hour\":{sel_hour},\"sel_min\":{sel_min}}" },
+  [KLAFS_REQUEST_STOP_CABIN] = { ENCODING_FORM, "id={id}" },
+  [KLAFS_REQUEST_CHANGE_TEMPERATURE] = { ENCODING_JSON, "{\"id\":\"{id}\",\"temperature\":{temperature}}" },
+  [KLAFS_REQUEST_CHANGE_HUMIDITY] = { ENCODING_JSON, "{\"id\":\"{id}\",\"level\":{hum_level}}" },
+  [KLAFS_REQUEST_SET_MODE] = { ENCODING_JSON, "{\"id\":\"{id}\",\"selected_mode\":{mode}}" },
+  [KLAFS_REQUEST_FAVORITE_SELECTED] = { ENCODING_JSON, "{\"id\":\"{id}\",\"temp\":{temperature},\"hum_level\":{hum_level},\"ir_level\":{ir_level}}" },
+  [KLAFS_REQUEST_POST_CONFIG_CHANGE] = { ENCODING_JSON, "{\"changedData\":{\"id\":\"{id}\",\"saunaSelected\":{sauna_selected},\"sanariumSelected\":{sanarium_selected},\"irSelected\":{ir_selected},"
+      "\"selectedSaunaTemperature\":{sauna_temperature},\"selectedSanariumTemperature\":{sanarium_temperature},\"selectedIrTemperature\":{ir_temperature},"
+      "\"selectedHumLevel\":{hum_level},\"selectedIrLevel\":{ir_level}}}" },
+};
+
+static pthread_once_t g_request_once = PTHREAD_ONCE_INIT;
+
+static const request_param_t* request_find_param(const char *name, size_t length) {
+  for (size_t i = 0; i < sizeof(g_request_params) / sizeof(g_request_params[0]); i++) {
+    if (strlen(g_request_params[i].name) == length && strncmp(g_request_params[i].name, name, length) == 0) {
+      return &g_request_params[i];
+    }
+  }
+  return NULL;
+}
+
+static void request_compile_template(request_template_t *template) {
+  const char *p = template->source;
+  const char *literal = p;
+
+  template->count = 0;
+  while (*p) {
+    const char *end;
+    const request_param_t *param;
+    if (*p == '{' && (end = strchr(p + 1, '}')) != NULL && (param = request_find_param(p + 1, end - p - 1)) != NULL) {
+      if (p > literal) {
+        template->segments[template->count].literal = literal;
+        template->segments[template->count].length = p - literal;
+        template->segments[template->count].param = NULL;
+        template->count++;
+      }
+      template->segments[template->count].literal = NULL;
+      template->segments[template->count].length = 0;
+      template->segments[template->count].param = param;
+      template->count++;
+      p = end + 1;
+      literal = p;
+    } else {
+      p++;
+    }
+  }
+  if (p > literal) {
+    template->segments[template->count].literal = literal;
+    template->segments[template->count].length = p - literal;
+    template->segments[template->count].param = NULL;
+    template->count++;
+  }
+}
+
+static void request_compile_templates() {
+  for (size_t i = 0; i < sizeof(g_request_templates) / sizeof(g_request_templates[0]); i++) {
+    request_compile_template(&g_request_templates[i]);
+  }
+}
+
+static bool request_append(char *buf, size_t *pos, const char *data, size_t length) {
+  if (*pos + length >= KLAFS_REQUEST_BUFSIZE) {
+    return false;
+  }
+  memcpy(buf + *pos, data, length);
+  *pos += length;
+  return true;
+}
+
+static bool request_append_string(char *buf, size_t *pos, const char *value, request_encoding_t encoding) {
+  static const char hex[] = "0123456789ABCDEF";
+  char escaped[6];
+
+  for (const unsigned char *c = (const unsigned char *) value; *c; c++) {
+    size_t length = 0;
+    if (encoding == ENCODING_JSON) {
+      if (*c == '"' || *c == '\\') {
+        escaped[length++] = '\\';
+        escaped[length++] = *c;
+      } else if (*c < 0x20) {
+        escaped[length++] = '\\';
+        escaped[length++] = 'u';
+        escaped[length++] = '0';
+        escaped[length++] = '0';
+        escaped[length++] = hex[*c >> 4];
+        escaped[length++] = hex[*c & 0x0f];
+      } else {
+        escaped[length++] = *c;
+      }
+    } else {
+      if ((*c >= 'a' && *c <= 'z') || (*c >= 'A' && *c <= 'Z') || (*c >= '0' && *c <= '9') || *c == '-' || *c == '_' || *c == '.' || *c == '~') {
+        escaped[length++] = *c;
+      } else {
+        escaped[length++] = '%';
+        escaped[length++] = hex[*c >> 4];
+        escaped[length++] = hex[*c & 0x0f];
+      }
+    }
+    if (!request_append(buf, pos, escaped, length)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/* renders a request body into the arena of the current cycle, so it is valid
+ * until the cycle ends; returns NULL if the body does not fit
+ */
+const char* klafs_render_request(klafs_request_t request, const klafs_request_params_t *params) {
+  pthread_once(&g_request_once, request_compile_templates);
+
+  request_template_t *template = &g_request_templates[request];
+  char *buf = arena_alloc(KLAFS_REQUEST_BUFSIZE);
+  size_t pos = 0;
+  bool ok = true;
+
+  if (buf == NULL) {
+    return NULL;
+  }
+
+  for (int i = 0; ok && i < template->count; i++) {
+    request_segment_t *segment = &template->segments[i];
+    if (segment->param == NULL) {
+      ok = request_append(buf, &pos, segment->literal, segment->length);
+      continue;
+    }
+
+    const char *field = (const char *) params + segment->param->offset;
+    char number[16];
+    int length;
+    switch (segment->param->type) {
+      case PARAM_STRING:
+        ok = request_append_string(buf, &pos, *(const char **) field ? *(const char **) field : "", template->encoding);
+        break;
+      case PARAM_INT:
+        length = snprintf(number, sizeof(number), "%d", *(const int *) field);
+        ok = request_append(buf, &pos, number, length);
+        break;
+      case PARAM_BOOL:
+        ok = *(const bool *) field ? request_append(buf, &pos, "true", 4) : request_append(buf, &pos, "false", 5);
+        break;
+    }
+  }
+
+  if (!ok) {
+    vdc_report(LOG_ERR, "network: request body for \"%s\" exceeds %d bytes\n", template->source, KLAFS_REQUEST_BUFSIZE);
+    arena_shrink(buf, 0);
+    return NULL;
+  }
+
+  buf[pos] = 0;
+  /* the rest of the buffer is left to the next allocation of the cycle */
+  arena_shrink(buf, pos + 1);
+  return buf;
+}
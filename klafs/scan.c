@@ -0,0 +1,337 @@
+/*
+ Author: Alexander Knauer <a-x-e@gmx.net>
+ License: Apache 2.0
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <pthread.h>
+
+#include <digitalSTROM/dsuid.h>
+#include <dsvdc/dsvdc.h>
+
+#include "klafs.h"
+
+/* scanner for the flat JSON objects returned by the klafs server (GetData):
+ * the members of the top level object are read into an array allocated in the
+ * arena of the current cycle, keys and strings unescaped and NUL terminated.
+ * Nested objects and arrays are validated and skipped. Numbers, booleans and
+ * strings are converted to int and bool like json-c's json_object_get_int()
+ * and json_object_get_boolean() did before.
+ */
+
+typedef struct scanner {
+  const char *p;
+  const char *end;
+} scanner_t;
+
+static void scan_space(scanner_t *s) {
+  while (s->p < s->end && (*s->p == ' ' || *s->p == '\t' || *s->p == '\n' || *s->p == '\r')) {
+    s->p++;
+  }
+}
+
+static int scan_hex4(const char *p) {
+  int value = 0;
+  for (int i = 0; i < 4; i++) {
+    char c = p[i];
+    value <<= 4;
+    if (c >= '0' && c <= '9') value |= c - '0';
+      else if (c >= 'a' && c <= 'f') value |= c - 'a' + 10;
+      else if (c >= 'A' && c <= 'F') value |= c - 'A' + 10;
+      else return -1;
+  }
+  return value;
+}
+
+static size_t scan_utf8(char *out, unsigned long cp) {
+  if (cp < 0x80) {
+    out[0] = cp;
+    return 1;
+  }
+  if (cp < 0x800) {
+    out[0] = 0xc0 | (cp >> 6);
+    out[1] = 0x80 | (cp & 0x3f);
+    return 2;
+  }
+  if (cp < 0x10000) {
+    out[0] = 0xe0 | (cp >> 12);
+    out[1] = 0x80 | ((cp >> 6) & 0x3f);
+    out[2] = 0x80 | (cp & 0x3f);
+    return 3;
+  }
+  out[0] = 0xf0 | (cp >> 18);
+  out[1] = 0x80 | ((cp >> 12) & 0x3f);
+  out[2] = 0x80 | ((cp >> 6) & 0x3f);
+  out[3] = 0x80 | (cp & 0x3f);
+  return 4;
+}
+
+/* string at s->p (the opening quote); the unescaped copy is stored in *value if not NULL */
+static bool scan_string(scanner_t *s, char **value) {
+  const char *start = ++s->p;
+  bool escaped = false;
+
+  while (s->p < s->end && *s->p != '"') {
+    if (*s->p == '\\') {
+      escaped = true;
+      s->p++;
+    } else if ((unsigned char) *s->p < 0x20) {
+      return false;
+    }
+    s->p++;
+  }
+  if (s->p >= s->end) {
+    return false;
+  }
+  const char *stop = s->p++;
+
+  if (value == NULL) {
+    return true;
+  }
+  if (!escaped) {
+    *value = arena_strndup(start, stop - start);
+    return *value != NULL;
+  }
+
+  /* unescaping never makes the string longer */
+  char *out = arena_alloc(stop - start + 1);
+  if (out == NULL) {
+    return false;
+  }
+  size_t length = 0;
+  for (const char *p = start; p < stop; p++) {
+    if (*p != '\\') {
+      out[length++] = *p;
+      continue;
+    }
+    p++;
+    switch (*p) {
+      case 'b': out[length++] = '\b'; break;
+      case 'f': out[length++] = '\f'; break;
+      case 'n': out[length++] = '\n'; break;
+      case 'r': out[length++] = '\r'; break;
+      case 't': out[length++] = '\t'; break;
+      case 'u': {
+        int cp = stop - p > 4 ? scan_hex4(p + 1) : -1;
+        if (cp < 0) {
+          return false;
+        }
+        p += 4;
+        unsigned long code = cp;
+        /* surrogate pair */
+        if (cp >= 0xd800 && cp < 0xdc00 && stop - p > 6 && p[1] == '\\' && p[2] == 'u') {
+          int low = scan_hex4(p + 3);
+          if (low >= 0xdc00 && low < 0xe000) {
+            code = 0x10000 + ((cp - 0xd800) << 10) + (low - 0xdc00);
+            p += 6;
+          }
+        }
+        length += scan_utf8(out + length, code);
+        break;
+      }
+      default:
+        out[length++] = *p;
+        break;
+    }
+  }
+  out[length] = '\0';
+  *value = out;
+  return true;
+}
+
+static bool scan_literal(scanner_t *s, const char *literal) {
+  size_t length = strlen(literal);
+  if ((size_t) (s->end - s->p) < length || strncmp(s->p, literal, length) != 0) {
+    return false;
+  }
+  s->p += length;
+  return true;
+}
+
+static bool scan_number(scanner_t *s, scan_member_t *member) {
+  const char *start = s->p;
+  bool fraction = false;
+
+  if (s->p < s->end && *s->p == '-') {
+    s->p++;
+  }
+  while (s->p < s->end && ((*s->p >= '0' && *s->p <= '9') || *s->p == '.' || *s->p == 'e' || *s->p == 'E' || *s->p == '+' || *s->p == '-')) {
+    if (*s->p == '.' || *s->p == 'e' || *s->p == 'E') {
+      fraction = true;
+    }
+    s->p++;
+  }
+  if (s->p == start || (s->p == start + 1 && *start == '-')) {
+    return false;
+  }
+
+  char number[64];
+  snprintf(number, sizeof(number), "%.*s", (int) (s->p - start), start);
+  if (fraction) {
+    double value = strtod(number, NULL);
+    member->type = SCAN_DOUBLE;
+    member->number = value >= INT_MAX ? INT_MAX : value <= INT_MIN ? INT_MIN : (int) value;
+    member->boolean = value != 0;
+  } else {
+    long long value = strtoll(number, NULL, 10);
+    member->type = SCAN_INT;
+    member->number = value >= INT_MAX ? INT_MAX : value <= INT_MIN ? INT_MIN : (int) value;
+    member->boolean = value != 0;
+  }
+  return true;
+}
+
+static bool scan_value(scanner_t *s, scan_member_t *member, int depth);
+
+/* nested object or array, validated and skipped */
+static bool scan_container(scanner_t *s, int depth) {
+  char close = *s->p == '{' ? '}' : ']';
+  bool object = close == '}';
+
+  if (depth > 32) {
+    return false;
+  }
+  s->p++;
+  scan_space(s);
+  if (s->p < s->end && *s->p == close) {
+    s->p++;
+    return true;
+  }
+  for (;;) {
+    scan_member_t ignored;
+    if (object) {
+      if (s->p >= s->end || *s->p != '"' || !scan_string(s, NULL)) {
+        return false;
+      }
+      scan_space(s);
+      if (s->p >= s->end || *s->p++ != ':') {
+        return false;
+      }
+      scan_space(s);
+    }
+    if (!scan_value(s, &ignored, depth + 1)) {
+      return false;
+    }
+    scan_space(s);
+    if (s->p >= s->end) {
+      return false;
+    }
+    if (*s->p == close) {
+      s->p++;
+      return true;
+    }
+    if (*s->p++ != ',') {
+      return false;
+    }
+    scan_space(s);
+  }
+}
+
+static bool scan_value(scanner_t *s, scan_member_t *member, int depth) {
+  member->number = 0;
+  member->boolean = false;
+  member->string = NULL;
+
+  if (s->p >= s->end) {
+    return false;
+  }
+  switch (*s->p) {
+    case '"':
+      if (depth > 0) {
+        member->type = SCAN_STRING;
+        return scan_string(s, NULL);
+      }
+      if (!scan_string(s, &member->string)) {
+        return false;
+      }
+      member->type = SCAN_STRING;
+      member->number = (int) strtol(member->string, NULL, 10);
+      member->boolean = member->string[0] != '\0';
+      return true;
+    case 't':
+      member->type = SCAN_BOOL;
+      member->number = 1;
+      member->boolean = true;
+      return scan_literal(s, "true");
+    case 'f':
+      member->type = SCAN_BOOL;
+      return scan_literal(s, "false");
+    case 'n':
+      member->type = SCAN_NULL;
+      return scan_literal(s, "null");
+    case '{':
+    case '[':
+      member->type = SCAN_OTHER;
+      return scan_container(s, depth);
+    default:
+      return scan_number(s, member);
+  }
+}
+
+/* members of the JSON object in data, allocated in the arena of the current
+ * cycle; returns the number of members or -1 if data is no valid JSON object
+ */
+int scan_object(const char *data, size_t size, scan_member_t **members) {
+  scanner_t s = { data, data + size };
+  int count = 0;
+  int capacity = 32;
+
+  *members = arena_alloc(capacity * sizeof(scan_member_t));
+  if (*members == NULL) {
+    return -1;
+  }
+
+  scan_space(&s);
+  if (s.p >= s.end || *s.p++ != '{') {
+    return -1;
+  }
+  scan_space(&s);
+  if (s.p < s.end && *s.p == '}') {
+    return 0;
+  }
+
+  for (;;) {
+    if (count == capacity) {
+      scan_member_t *grown = arena_alloc(2 * capacity * sizeof(scan_member_t));
+      if (grown == NULL) {
+        return -1;
+      }
+      memcpy(grown, *members, count * sizeof(scan_member_t));
+      *members = grown;
+      capacity *= 2;
+    }
+    scan_member_t *member = &(*members)[count];
+
+    if (s.p >= s.end || *s.p != '"' || !scan_string(&s, &member->key)) {
+      return -1;
+    }
+    scan_space(&s);
+    if (s.p >= s.end || *s.p++ != ':') {
+      return -1;
+    }
+    scan_space(&s);
+    if (!scan_value(&s, member, 0)) {
+      return -1;
+    }
+    count++;
+
+    scan_space(&s);
+    if (s.p >= s.end) {
+      return -1;
+    }
+    if (*s.p == '}') {
+      return count;
+    }
+    if (*s.p++ != ',') {
+      return -1;
+    }
+    scan_space(&s);
+  }
+}
@@ -0,0 +1,83 @@
+/*
+ Author: Alexander Knauer <a-x-e@gmx.net>
+ License: Apache 2.0
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <digitalSTROM/dsuid.h>
+#include <dsvdc/dsvdc.h>
+
+#include "klafs.h"
+
+/* field table of scene_t, generated from KLAFS_SCENE_FIELDS; the key names are
+ * the member names, so config keys, GetData keys and struct members cannot
+ * diverge. Fields are accessed through generated accessors, since the flags
+ * are bit-fields. Lookups by name use a sorted index and bsearch.
+ */
+
+#define SCENE_BOOL_ACCESSORS(name, flags) \
+  static int scene_get_##name(const scene_t *scene) { return scene->name; } \
+  static void scene_set_##name(scene_t *scene, int value) { scene->name = (value != 0); }
+#define SCENE_INT_ACCESSORS(type, name, flags) \
+  static int scene_get_##name(const scene_t *scene) { return scene->name; } \
+  static void scene_set_##name(scene_t *scene, int value) { scene->name = (type) value; }
+
+KLAFS_SCENE_FIELDS(SCENE_BOOL_ACCESSORS, SCENE_INT_ACCESSORS)
+
+#define SCENE_BOOL_ENTRY(name, flags) { #name, SCENE_FIELD_BOOL, scene_get_##name, scene_set_##name, flags },
+#define SCENE_INT_ENTRY(type, name, flags) { #name, SCENE_FIELD_INT, scene_get_##name, scene_set_##name, flags },
+
+const scene_field_t g_scene_fields[] = {
+  KLAFS_SCENE_FIELDS(SCENE_BOOL_ENTRY, SCENE_INT_ENTRY)
+};
+
+const size_t g_scene_field_count = sizeof(g_scene_fields) / sizeof(g_scene_fields[0]);
+
+static const scene_field_t *g_scene_field_index[sizeof(g_scene_fields) / sizeof(g_scene_fields[0])];
+static pthread_once_t g_scene_field_once = PTHREAD_ONCE_INIT;
+
+static int scene_field_compare(const void *a, const void *b) {
+  return strcmp((*(const scene_field_t **) a)->name, (*(const scene_field_t **) b)->name);
+}
+
+static int scene_field_compare_key(const void *key, const void *field) {
+  return strcmp((const char *) key, (*(const scene_field_t **) field)->name);
+}
+
+static void scene_field_build_index() {
+  for (size_t i = 0; i < g_scene_field_count; i++) {
+    g_scene_field_index[i] = &g_scene_fields[i];
+  }
+  qsort(g_scene_field_index, g_scene_field_count, sizeof(g_scene_field_index[0]), scene_field_compare);
+}
+
+const scene_field_t* scene_field_find(const char *name) {
+  pthread_once(&g_scene_field_once, scene_field_build_index);
+
+  const scene_field_t **field = bsearch(name, g_scene_field_index, g_scene_field_count, sizeof(g_scene_field_index[0]), scene_field_compare_key);
+  return field != NULL ? *field : NULL;
+}
+
+int scene_field_get(const scene_t *scene, const scene_field_t *field) {
+  return field->get(scene);
+}
+
+void scene_field_set(scene_t *scene, const scene_field_t *field, int value) {
+  field->set(scene, value);
+}
+
+/* copies all fields having one of the given flags */
+void scene_copy_fields(scene_t *dst, const scene_t *src, unsigned int flags) {
+  for (size_t i = 0; i < g_scene_field_count; i++) {
+    if (g_scene_fields[i].flags & flags) {
+      scene_field_set(dst, &g_scene_fields[i], scene_field_get(src, &g_scene_fields[i]));
+    }
+  }
+}
@@ -0,0 +1,108 @@
+/*
+ Author: Alexander Knauer <a-x-e@gmx.net>
+ License: Apache 2.0
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <digitalSTROM/dsuid.h>
+#include <dsvdc/dsvdc.h>
+
+#include "klafs.h"
+
+/* scheduled start of power on scenes with timeSelected = 1 at selectedHour:selectedMinute;
+ * by default the start time is handed to the klafs server with the StartCabin request,
+ * with schedule_local = 1 the vDC arms a timer for the start and one for checking the
+ * session schedule_prewarm seconds before
+ */
+
+static void schedule_prewarm(void *arg);
+static void schedule_fire(void *arg);
+
+static pthread_mutex_t g_schedule_mutex = PTHREAD_MUTEX_INITIALIZER;
+static scene_t g_schedule_scene;
+static klafs_timer_t g_schedule_prewarm_timer = KLAFS_TIMER_INIT("schedule prewarm", schedule_prewarm);
+static klafs_timer_t g_schedule_start_timer = KLAFS_TIMER_INIT("schedule start", schedule_fire);
+
+/* next occurrence of hour:minute local time after now */
+static time_t schedule_next_time(int hour, int minute, time_t now) {
+  struct tm tm;
+  localtime_r(&now, &tm);
+  tm.tm_hour = hour;
+  tm.tm_min = minute;
+  tm.tm_sec = 0;
+  tm.tm_isdst = -1;
+  time_t start = mktime(&tm);
+  if (start <= now) {
+    tm.tm_mday++;
+    tm.tm_isdst = -1;
+    start = mktime(&tm);
+  }
+  return start;
+}
+
+static int schedule_start_now(scene_t *scene) {
+  klafs_change_configuration(scene, KLAFS_CHANGE_ALL);
+  return klafs_power_on();
+}
+
+int schedule_start(scene_t *scene) {
+  if (scene->selectedHour < 0 || scene->selectedHour > 23 || scene->selectedMinute < 0 || scene->selectedMinute > 59) {
+    vdc_report(LOG_WARNING, "schedule: scene %d has no valid start time %d:%d, starting now\n", scene->dsId, scene->selectedHour, scene->selectedMinute);
+    return schedule_start_now(scene);
+  }
+
+  if (!g_schedule_local) {
+    vdc_report(LOG_NOTICE, "schedule: klafs server starts scene %d at %02d:%02d\n", scene->dsId, scene->selectedHour, scene->selectedMinute);
+    klafs_change_configuration(scene, KLAFS_CHANGE_ALL);
+    return klafs_power_on_at(scene->selectedHour, scene->selectedMinute);
+  }
+
+  time_t now = time(NULL);
+  time_t delay = schedule_next_time(scene->selectedHour, scene->selectedMinute, now) - now;
+
+  pthread_mutex_lock(&g_schedule_mutex);
+  if (timer_is_armed(&g_schedule_start_timer)) {
+    vdc_report(LOG_INFO, "schedule: replacing start of scene %d\n", g_schedule_scene.dsId);
+  }
+  g_schedule_scene = *scene;
+  pthread_mutex_unlock(&g_schedule_mutex);
+
+  timer_cancel(&g_schedule_prewarm_timer);
+  if (delay > g_schedule_prewarm) {
+    timer_arm(&g_schedule_prewarm_timer, (uint64_t) (delay - g_schedule_prewarm) * 1000);
+  }
+  timer_arm(&g_schedule_start_timer, (uint64_t) delay * 1000);
+
+  vdc_report(LOG_NOTICE, "schedule: scene %d starts at %02d:%02d (in %ld seconds)\n", scene->dsId, scene->selectedHour, scene->selectedMinute, (long) delay);
+  return KLAFS_OK;
+}
+
+void schedule_cancel() {
+  timer_cancel(&g_schedule_prewarm_timer);
+  if (timer_cancel(&g_schedule_start_timer)) {
+    vdc_report(LOG_NOTICE, "schedule: start of scene %d cancelled\n", g_schedule_scene.dsId);
+  }
+}
+
+/* timer callbacks on the network thread */
+static void schedule_prewarm(void *arg __attribute__((unused))) {
+  vdc_report(LOG_INFO, "schedule: checking klafs session before the start\n");
+  klafs_validate_authcookie(klafs.aspxauth);
+}
+
+static void schedule_fire(void *arg __attribute__((unused))) {
+  pthread_mutex_lock(&g_schedule_mutex);
+  scene_t scene = g_schedule_scene;
+  pthread_mutex_unlock(&g_schedule_mutex);
+
+  vdc_report(LOG_NOTICE, "schedule: starting scene %d\n", scene.dsId);
+  schedule_start_now(&scene);
+}
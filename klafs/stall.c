@@ -0,0 +1,219 @@
+/*
+ Author: Alexander Knauer <a-x-e@gmx.net>
+ License: Apache 2.0
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <digitalSTROM/dsuid.h>
+#include <dsvdc/dsvdc.h>
+
+#include "klafs.h"
+
+/* stall detector for the main loop: the dsvdc callbacks run inside dsvdc_work()
+ * and a callback waiting for the klafs server delays the answers to dSS, up to
+ * ping timeouts. Every callback and every main loop iteration is timed into a
+ * histogram; a callback taking longer than stall_threshold ms, or an iteration
+ * taking that much longer than its dsvdc_work() timeout, is logged with the
+ * callback and the last klafs endpoint it used.
+ * Callbacks and the loop run on the main thread only, so no locking is needed.
+ */
+
+static stall_histogram_t g_stall_loop;
+static stall_histogram_t g_stall_callbacks;
+
+static __thread const char *g_stall_endpoint = NULL;
+
+static uint64_t g_stall_loop_mark = 0;
+static int g_stall_loop_wait = 0;
+
+static const char *g_stall_callback = NULL;
+static uint64_t g_stall_callback_start = 0;
+
+/* slowest callback of the current loop iteration */
+static const char *g_stall_slowest = NULL;
+static const char *g_stall_slowest_endpoint = NULL;
+static uint64_t g_stall_slowest_ms = 0;
+
+static void stall_record(stall_histogram_t *histogram, uint64_t ms) {
+  int bucket = 0;
+  while (bucket < STALL_BUCKETS - 1 && ms >= (1ULL << bucket)) {
+    bucket++;
+  }
+  histogram->count[bucket]++;
+  if (ms > histogram->max_ms) {
+    histogram->max_ms = ms;
+  }
+}
+
+/* remembers the klafs url requested by the current thread */
+void stall_set_endpoint(const char *url) {
+  g_stall_endpoint = url;
+}
+
+/* called at the start of every main loop iteration with its dsvdc_work() timeout */
+void stall_loop_mark(int wait_secs) {
+  uint64_t now = timer_now_ms();
+
+  if (g_stall_loop_mark != 0) {
+    uint64_t duration = now - g_stall_loop_mark;
+    stall_record(&g_stall_loop, duration);
+    if (duration > (uint64_t) g_stall_loop_wait * 1000 + g_stall_threshold) {
+      g_stall_loop.stalls++;
+      vdc_report(LOG_WARNING, "stall: main loop iteration took %llu ms, slowest callback %s (%llu ms), klafs endpoint %s\n",
+          (unsigned long long) duration, g_stall_slowest ? g_stall_slowest : "none", (unsigned long long) g_stall_slowest_ms,
+          g_stall_slowest_endpoint ? g_stall_slowest_endpoint : "none");
+    }
+  }
+
+  g_stall_loop_mark = now;
+  g_stall_loop_wait = wait_secs;
+  g_stall_slowest = NULL;
+  g_stall_slowest_endpoint = NULL;
+  g_stall_slowest_ms = 0;
+}
+
+static void stall_callback_begin(const char *name) {
+  g_stall_callback = name;
+  g_stall_endpoint = NULL;
+  g_stall_callback_start = timer_now_ms();
+  arena_begin();
+}
+
+static void stall_callback_end() {
+  arena_end();
+  uint64_t duration = timer_now_ms() - g_stall_callback_start;
+
+  stall_record(&g_stall_callbacks, duration);
+  if (duration >= g_stall_slowest_ms) {
+    g_stall_slowest = g_stall_callback;
+    g_stall_slowest_endpoint = g_stall_endpoint;
+    g_stall_slowest_ms = duration;
+  }
+  if (duration > (uint64_t) g_stall_threshold) {
+    g_stall_callbacks.stalls++;
+    vdc_report(LOG_WARNING, "stall: callback %s took %llu ms, klafs endpoint %s\n",
+        g_stall_callback, (unsigned long long) duration, g_stall_endpoint ? g_stall_endpoint : "none");
+  }
+  g_stall_callback = NULL;
+}
+
+static void stall_add_histogram(dsvdc_property_t *property, const char *name, const stall_histogram_t *histogram) {
+  dsvdc_property_t *reply;
+  dsvdc_property_t *buckets;
+  char key[16];
+
+  if (dsvdc_property_new(&reply) != DSVDC_OK) {
+    vdc_report(LOG_ERR, "failed to allocate reply property for %s\n", name);
+    return;
+  }
+  if (dsvdc_property_new(&buckets) != DSVDC_OK) {
+    vdc_report(LOG_ERR, "failed to allocate reply property for %s\n", name);
+    dsvdc_property_free(reply);
+    return;
+  }
+
+  /* keyed by the upper bound of the bucket in ms */
+  for (int i = 0; i < STALL_BUCKETS; i++) {
+    if (i < STALL_BUCKETS - 1) {
+      snprintf(key, sizeof(key), "%llu", 1ULL << i);
+    } else {
+      strcpy(key, "more");
+    }
+    dsvdc_property_add_uint(buckets, key, histogram->count[i]);
+  }
+
+  dsvdc_property_add_uint(reply, "maxMs", histogram->max_ms);
+  dsvdc_property_add_uint(reply, "stalls", histogram->stalls);
+  dsvdc_property_add_property(reply, "histogram", &buckets);
+  dsvdc_property_add_property(property, name, &reply);
+}
+
+/* vDC property x-klafs-latency */
+void stall_add_property(dsvdc_property_t *property, const char *name) {
+  dsvdc_property_t *reply;
+  if (dsvdc_property_new(&reply) != DSVDC_OK) {
+    vdc_report(LOG_ERR, "failed to allocate reply property for %s\n", name);
+    return;
+  }
+  dsvdc_property_add_uint(reply, "thresholdMs", g_stall_threshold);
+  stall_add_histogram(reply, "loop", &g_stall_loop);
+  stall_add_histogram(reply, "callbacks", &g_stall_callbacks);
+  dsvdc_property_add_property(property, name, &reply);
+}
+
+/*
+ * timed wrappers of the dsvdc callbacks, registered in main(); every callback
+ * is one arena cycle (arena.c), callbacks which may send klafs requests start
+ * a trace (trace.c)
+ */
+
+void stall_ping_cb(dsvdc_t *handle, const char *dsuid, void *userdata) {
+  stall_callback_begin("ping");
+  vdc_ping_cb(handle, dsuid, userdata);
+  stall_callback_end();
+}
+
+bool stall_remove_cb(dsvdc_t *handle, const char *dsuid, void *userdata) {
+  stall_callback_begin("remove");
+  bool ret = vdc_remove_cb(handle, dsuid, userdata);
+  stall_callback_end();
+  return ret;
+}
+
+void stall_new_session_cb(dsvdc_t *handle, void *userdata) {
+  stall_callback_begin("new session");
+  vdc_new_session_cb(handle, userdata);
+  stall_callback_end();
+}
+
+void stall_end_session_cb(dsvdc_t *handle, void *userdata) {
+  stall_callback_begin("end session");
+  vdc_end_session_cb(handle, userdata);
+  stall_callback_end();
+}
+
+void stall_getprop_cb(dsvdc_t *handle, const char *dsuid, dsvdc_property_t *property, const dsvdc_property_t *query, void *userdata) {
+  stall_callback_begin("get property");
+  vdc_getprop_cb(handle, dsuid, property, query, userdata);
+  stall_callback_end();
+}
+
+void stall_setprop_cb(dsvdc_t *handle, const char *dsuid, dsvdc_property_t *property, const dsvdc_property_t *properties, void *userdata) {
+  stall_callback_begin("set property");
+  trace_begin();
+  vdc_setprop_cb(handle, dsuid, property, properties, userdata);
+  trace_end("set property", "callback");
+  stall_callback_end();
+}
+
+void stall_callscene_cb(dsvdc_t *handle, char **dsuid, size_t n_dsuid, int32_t scene, bool force, int32_t *group, int32_t *zone_id, void *userdata) {
+  stall_callback_begin("call scene");
+  trace_begin();
+  vdc_callscene_cb(handle, dsuid, n_dsuid, scene, force, group, zone_id, userdata);
+  trace_end("call scene", "callback");
+  stall_callback_end();
+}
+
+void stall_savescene_cb(dsvdc_t *handle, char **dsuid, size_t n_dsuid, int32_t scene, int32_t *group, int32_t *zone_id, void *userdata) {
+  stall_callback_begin("save scene");
+  trace_begin();
+  vdc_savescene_cb(handle, dsuid, n_dsuid, scene, group, zone_id, userdata);
+  trace_end("save scene", "callback");
+  stall_callback_end();
+}
+
+void stall_request_generic_cb(dsvdc_t *handle, char *dsuid, char *method_name, dsvdc_property_t *property, const dsvdc_property_t *properties, void *userdata) {
+  stall_callback_begin("generic request");
+  trace_begin();
+  vdc_request_generic_cb(handle, dsuid, method_name, property, properties, userdata);
+  trace_end("generic request", "callback");
+  stall_callback_end();
+}
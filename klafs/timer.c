@@ -0,0 +1,196 @@
+/*
+ Author: Alexander Knauer <a-x-e@gmx.net>
+ License: Apache 2.0
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <utlist.h>
+
+#include <digitalSTROM/dsuid.h>
+#include <dsvdc/dsvdc.h>
+
+#include "klafs.h"
+
+/* hashed timer wheel on CLOCK_MONOTONIC for the periodic work of the network
+ * thread: a timer is kept in slot (tick % TIMER_SLOTS) of the tick it is due
+ * in, so arming and cancelling are O(1) and a run only visits the slots
+ * passed since the last one. timer_run() sleeps until the next due tick and
+ * runs the callbacks without holding the wheel lock; the delay of every
+ * callback behind its due time is counted as jitter in g_stats.
+ */
+
+#define TIMER_TICK_MS 100
+#define TIMER_SLOTS 256
+#define TIMER_IDLE_MS 60000
+
+static klafs_timer_t *g_timer_slots[TIMER_SLOTS];
+static uint64_t g_timer_cursor = 0;
+static unsigned int g_timer_count = 0;
+static bool g_timer_stopped = false;
+static pthread_mutex_t g_timer_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_timer_cond;
+
+uint64_t timer_now_ms() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t) now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+void timer_init() {
+  pthread_condattr_t attr;
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&g_timer_cond, &attr);
+  pthread_condattr_destroy(&attr);
+
+  g_timer_cursor = timer_now_ms() / TIMER_TICK_MS;
+}
+
+static void timer_remove_locked(klafs_timer_t *timer) {
+  DL_DELETE(g_timer_slots[timer->tick % TIMER_SLOTS], timer);
+  timer->armed = false;
+  g_timer_count--;
+}
+
+/* (re)arms the timer to run its callback delay_ms from now */
+void timer_arm(klafs_timer_t *timer, uint64_t delay_ms) {
+  pthread_mutex_lock(&g_timer_mutex);
+  if (timer->armed) {
+    timer_remove_locked(timer);
+  }
+  timer->expires = timer_now_ms() + delay_ms;
+  /* round up, a timer never runs before its time */
+  timer->tick = (timer->expires + TIMER_TICK_MS - 1) / TIMER_TICK_MS;
+  if (timer->tick < g_timer_cursor) {
+    timer->tick = g_timer_cursor;
+  }
+  DL_APPEND(g_timer_slots[timer->tick % TIMER_SLOTS], timer);
+  timer->armed = true;
+  g_timer_count++;
+  pthread_cond_signal(&g_timer_cond);
+  pthread_mutex_unlock(&g_timer_mutex);
+}
+
+/* returns true if the timer was armed */
+bool timer_cancel(klafs_timer_t *timer) {
+  pthread_mutex_lock(&g_timer_mutex);
+  bool armed = timer->armed;
+  if (armed) {
+    timer_remove_locked(timer);
+  }
+  pthread_mutex_unlock(&g_timer_mutex);
+  return armed;
+}
+
+bool timer_is_armed(klafs_timer_t *timer) {
+  pthread_mutex_lock(&g_timer_mutex);
+  bool armed = timer->armed;
+  pthread_mutex_unlock(&g_timer_mutex);
+  return armed;
+}
+
+/* the first due tick, searched from the cursor; 0 if no timer is armed */
+static uint64_t timer_next_tick_locked() {
+  uint64_t next = 0;
+  klafs_timer_t *timer;
+
+  if (g_timer_count == 0) {
+    return 0;
+  }
+  for (uint64_t tick = g_timer_cursor; tick < g_timer_cursor + TIMER_SLOTS; tick++) {
+    DL_FOREACH(g_timer_slots[tick % TIMER_SLOTS], timer) {
+      if (timer->tick == tick) {
+        return tick;
+      }
+    }
+  }
+  /* all timers are more than one revolution away */
+  for (int slot = 0; slot < TIMER_SLOTS; slot++) {
+    DL_FOREACH(g_timer_slots[slot], timer) {
+      if (next == 0 || timer->tick < next) {
+        next = timer->tick;
+      }
+    }
+  }
+  return next;
+}
+
+/* runs the due timers of one slot; called and returns with the lock held */
+static void timer_expire_slot_locked(int slot, uint64_t now_tick) {
+  klafs_timer_t *timer;
+
+restart:
+  DL_FOREACH(g_timer_slots[slot], timer) {
+    if (timer->tick > now_tick) {
+      continue;
+    }
+    timer_remove_locked(timer);
+
+    uint64_t now = timer_now_ms();
+    uint64_t jitter = now > timer->expires ? now - timer->expires : 0;
+    g_stats.timers_fired++;
+    g_stats.timer_jitter_total_ms += jitter;
+    if (jitter > g_stats.timer_jitter_max_ms) {
+      g_stats.timer_jitter_max_ms = jitter;
+    }
+    if (jitter > 1000) {
+      vdc_report(LOG_INFO, "timer: %s runs %llu ms late\n", timer->name, (unsigned long long) jitter);
+    }
+
+    /* every callback is one arena cycle, its temporary memory is released on return */
+    pthread_mutex_unlock(&g_timer_mutex);
+    arena_begin();
+    timer->fn(timer->arg);
+    arena_end();
+    pthread_mutex_lock(&g_timer_mutex);
+
+    /* the callback may have changed the slot */
+    goto restart;
+  }
+}
+
+/* runs the armed timers until timer_stop() is called or the daemon shuts down */
+void timer_run() {
+  pthread_mutex_lock(&g_timer_mutex);
+  while (!g_timer_stopped && !g_shutdown_flag) {
+    uint64_t now_tick = timer_now_ms() / TIMER_TICK_MS;
+
+    /* after a long sleep every slot is visited once, due timers of skipped ticks are in them */
+    if (now_tick >= g_timer_cursor + TIMER_SLOTS) {
+      g_timer_cursor = now_tick - TIMER_SLOTS + 1;
+    }
+    /* the cursor is advanced before a slot runs, so callbacks arm timers for later ticks only */
+    while (g_timer_cursor <= now_tick) {
+      uint64_t tick = g_timer_cursor++;
+      timer_expire_slot_locked(tick % TIMER_SLOTS, now_tick);
+    }
+
+    /* time passed while the callbacks were running */
+    uint64_t next = timer_next_tick_locked();
+    if (next != 0 && next <= timer_now_ms() / TIMER_TICK_MS) {
+      continue;
+    }
+
+    struct timespec until;
+    uint64_t until_ms = next != 0 ? next * TIMER_TICK_MS : timer_now_ms() + TIMER_IDLE_MS;
+    until.tv_sec = until_ms / 1000;
+    until.tv_nsec = (until_ms % 1000) * 1000000;
+    pthread_cond_timedwait(&g_timer_cond, &g_timer_mutex, &until);
+  }
+  pthread_mutex_unlock(&g_timer_mutex);
+}
+
+void timer_stop() {
+  pthread_mutex_lock(&g_timer_mutex);
+  g_timer_stopped = true;
+  pthread_cond_signal(&g_timer_cond);
+  pthread_mutex_unlock(&g_timer_mutex);
+}
@@ -0,0 +1,231 @@
+/*
+ Author: Alexander Knauer <a-x-e@gmx.net>
+ License: Apache 2.0
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <digitalSTROM/dsuid.h>
+#include <dsvdc/dsvdc.h>
+
+#include "klafs.h"
+
+/* end-to-end request tracing: a dSS callback or a poll of the network thread
+ * starts a trace, its id is kept per thread and handed on to the push queue,
+ * so every span recorded for it (lock waits, http phases from curl, parsing,
+ * push queueing and sending) carries the same id. The last trace_spans spans
+ * are kept in a ring buffer; on SIGUSR1 the main loop writes them to
+ * trace_file in the Chrome trace-event format (chrome://tracing, Perfetto).
+ * Nothing is recorded while trace_spans is 0 or no trace is active.
+ */
+
+#define TRACE_DETAIL_SIZE 64
+
+typedef struct trace_span {
+  unsigned long trace;
+  long tid;
+  const char *name;
+  const char *category;
+  uint64_t start_us;
+  uint64_t end_us;
+  char detail[TRACE_DETAIL_SIZE];
+} trace_span_t;
+
+static trace_span_t *g_trace_ring = NULL;
+static size_t g_trace_size = 0;
+static size_t g_trace_next = 0;
+static size_t g_trace_used = 0;
+static unsigned long g_trace_last_id = 0;
+static pthread_mutex_t g_trace_mutex = PTHREAD_MUTEX_INITIALIZER;
+static volatile sig_atomic_t g_trace_export_requested = 0;
+
+static __thread unsigned long g_trace_id = 0;
+static __thread uint64_t g_trace_start = 0;
+
+uint64_t trace_now_us() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+/* (re)allocates the ring buffer if g_trace_spans changed, recorded spans are dropped then */
+int trace_init() {
+  pthread_mutex_lock(&g_trace_mutex);
+  if (g_trace_size == (size_t) (g_trace_spans > 0 ? g_trace_spans : 0)) {
+    pthread_mutex_unlock(&g_trace_mutex);
+    return KLAFS_OK;
+  }
+  free(g_trace_ring);
+  g_trace_ring = NULL;
+  g_trace_size = 0;
+  g_trace_next = 0;
+  g_trace_used = 0;
+  if (g_trace_spans > 0) {
+    g_trace_ring = calloc(g_trace_spans, sizeof(trace_span_t));
+    if (g_trace_ring == NULL) {
+      pthread_mutex_unlock(&g_trace_mutex);
+      vdc_report(LOG_ERR, "trace: out of memory for %d spans\n", g_trace_spans);
+      return KLAFS_OUT_OF_MEMORY;
+    }
+    g_trace_size = g_trace_spans;
+  }
+  pthread_mutex_unlock(&g_trace_mutex);
+  return KLAFS_OK;
+}
+
+void trace_cleanup() {
+  pthread_mutex_lock(&g_trace_mutex);
+  free(g_trace_ring);
+  g_trace_ring = NULL;
+  g_trace_size = 0;
+  pthread_mutex_unlock(&g_trace_mutex);
+}
+
+/* starts a new trace on the calling thread; a trace already running is continued */
+void trace_begin() {
+  if (g_trace_spans <= 0 || g_trace_id != 0) {
+    return;
+  }
+  pthread_mutex_lock(&g_trace_mutex);
+  g_trace_id = ++g_trace_last_id;
+  pthread_mutex_unlock(&g_trace_mutex);
+  g_trace_start = trace_now_us();
+}
+
+/* records the root span of the trace started by trace_begin() and ends it */
+void trace_end(const char *name, const char *category) {
+  if (g_trace_id == 0) {
+    return;
+  }
+  trace_span(name, category, g_trace_start, trace_now_us(), NULL);
+  g_trace_id = 0;
+}
+
+/* id of the trace running on the calling thread, 0 if none */
+unsigned long trace_current() {
+  return g_trace_id;
+}
+
+/* continues the trace id on the calling thread, 0 detaches it */
+void trace_set(unsigned long id) {
+  g_trace_id = id;
+}
+
+void trace_span(const char *name, const char *category, uint64_t start_us, uint64_t end_us, const char *detail) {
+  if (g_trace_id == 0) {
+    return;
+  }
+  long tid = syscall(SYS_gettid);
+
+  pthread_mutex_lock(&g_trace_mutex);
+  if (g_trace_size == 0) {
+    pthread_mutex_unlock(&g_trace_mutex);
+    return;
+  }
+  trace_span_t *span = &g_trace_ring[g_trace_next];
+  span->trace = g_trace_id;
+  span->tid = tid;
+  span->name = name;
+  span->category = category;
+  span->start_us = start_us;
+  span->end_us = end_us > start_us ? end_us : start_us;
+  snprintf(span->detail, sizeof(span->detail), "%s", detail ? detail : "");
+  g_trace_next = (g_trace_next + 1) % g_trace_size;
+  if (g_trace_used < g_trace_size) {
+    g_trace_used++;
+  }
+  pthread_mutex_unlock(&g_trace_mutex);
+}
+
+/* locks mutex and records the wait as lock span of the running trace */
+void trace_lock(pthread_mutex_t *mutex, const char *name) {
+  if (g_trace_id == 0) {
+    pthread_mutex_lock(mutex);
+    return;
+  }
+  uint64_t start = trace_now_us();
+  pthread_mutex_lock(mutex);
+  trace_span(name, "lock", start, trace_now_us(), NULL);
+}
+
+/* called from the signal handler, the export is written by the main loop */
+void trace_request_export() {
+  g_trace_export_requested = 1;
+}
+
+static void trace_write_string(FILE *f, const char *s) {
+  fputc('"', f);
+  for (; *s; s++) {
+    if (*s == '"' || *s == '\\') {
+      fputc('\\', f);
+      fputc(*s, f);
+    } else if ((unsigned char) *s < 0x20) {
+      fprintf(f, "\\u%04x", (unsigned char) *s);
+    } else {
+      fputc(*s, f);
+    }
+  }
+  fputc('"', f);
+}
+
+/* writes the recorded spans as complete ("X") events of the Chrome trace-event format */
+int trace_export(const char *path) {
+  FILE *f = fopen(path, "w");
+  if (f == NULL) {
+    vdc_report(LOG_ERR, "trace: cannot write %s\n", path);
+    return KLAFS_WRITE_FAILED;
+  }
+
+  pthread_mutex_lock(&g_trace_mutex);
+  size_t first = (g_trace_next + g_trace_size - g_trace_used) % (g_trace_size ? g_trace_size : 1);
+  size_t count = g_trace_used;
+
+  fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+  for (size_t i = 0; i < count; i++) {
+    const trace_span_t *span = &g_trace_ring[(first + i) % g_trace_size];
+    fprintf(f, "%s\n{\"name\":", i > 0 ? "," : "");
+    trace_write_string(f, span->name);
+    fprintf(f, ",\"cat\":");
+    trace_write_string(f, span->category);
+    fprintf(f, ",\"ph\":\"X\",\"pid\":%d,\"tid\":%ld,\"ts\":%llu,\"dur\":%llu,\"args\":{\"trace\":%lu",
+        (int) getpid(), span->tid, (unsigned long long) span->start_us,
+        (unsigned long long) (span->end_us - span->start_us), span->trace);
+    if (span->detail[0] != '\0') {
+      fprintf(f, ",\"detail\":");
+      trace_write_string(f, span->detail);
+    }
+    fprintf(f, "}}");
+  }
+  fprintf(f, "\n]}\n");
+  pthread_mutex_unlock(&g_trace_mutex);
+
+  if (fclose(f) != 0) {
+    vdc_report(LOG_ERR, "trace: writing %s failed\n", path);
+    return KLAFS_WRITE_FAILED;
+  }
+  vdc_report(LOG_NOTICE, "trace: %zu spans written to %s\n", count, path);
+  return KLAFS_OK;
+}
+
+/* main loop: writes the export requested by SIGUSR1 */
+void trace_export_pending() {
+  if (!g_trace_export_requested) {
+    return;
+  }
+  g_trace_export_requested = 0;
+  if (g_trace_spans <= 0) {
+    vdc_report(LOG_NOTICE, "trace: tracing is disabled (trace_spans = 0)\n");
+    return;
+  }
+  trace_export(g_trace_file);
+}
@@ -17,7 +17,6 @@
 
 #include <libconfig.h>
 #include <curl/curl.h>
-#include <json.h>
 #include <utlist.h>
 
 #include <digitalSTROM/dsuid.h>
@@ -120,14 +119,12 @@ void vdc_request_generic_cb(dsvdc_t *handle __attribute__((unused)), char *dsuid
         if (ret != DSVDC_OK) {
           vdc_report(LOG_ERR, "request_generic_cb: error getting property value from property %s\n", name);
           code = DSVDC_ERR_INVALID_VALUE_TYPE;
+          free(name);
           break;
         }
         
-        scene_t *scene_data;
-        scene_data = malloc(sizeof(scene_t));
-        if (!scene_data) {
-          return;
-        }
+        scene_t scene;
+        scene_t *scene_data = &scene;
         memset(scene_data, 0, sizeof(scene_t));
           
         if(strcasecmp(id, "ActTurnOn") == 0) {
@@ -142,27 +139,26 @@ void vdc_request_generic_cb(dsvdc_t *handle __attribute__((unused)), char *dsuid
           scene_data->saunaSelected = true;
           scene_data->sanariumSelected = false;
           scene_data->irSelected = false;
-          klafs_change_mode(scene_data);
+          klafs_change_configuration(scene_data, KLAFS_CHANGE_MODE);
         } else if(strcasecmp(id, "ActModeSanarium") == 0) {
           vdc_report(LOG_DEBUG, "Exec Mode Sanarium command");
           scene_data->saunaSelected = false;
           scene_data->sanariumSelected = true;
           scene_data->irSelected = false;
-          klafs_change_mode(scene_data);
+          klafs_change_configuration(scene_data, KLAFS_CHANGE_MODE);
         } else if(strcasecmp(id, "ActModeIR") == 0) {
           vdc_report(LOG_DEBUG, "Exec Mode IR command");
           scene_data->saunaSelected = false;
           scene_data->sanariumSelected = false;
           scene_data->irSelected = true;
-          klafs_change_mode(scene_data);
+          klafs_change_configuration(scene_data, KLAFS_CHANGE_MODE);
         } else if(strcasecmp(id, "ActSommerSaunaClassic") == 0) {
           vdc_report(LOG_DEBUG, "Exec Program SommerSaunaClassic command");
           scene_data->saunaSelected = true;
           scene_data->sanariumSelected = false;
           scene_data->irSelected = false;
           scene_data->selectedSaunaTemperature = 75;
-          klafs_change_mode(scene_data);
-          klafs_change_temperature(scene_data);
+          klafs_change_configuration(scene_data, KLAFS_CHANGE_MODE | KLAFS_CHANGE_TEMPERATURE);
           klafs_power_on();
         } else if(strcasecmp(id, "ActChilloutSauna") == 0) {
           vdc_report(LOG_DEBUG, "Exec Program ChilloutSauna command");
@@ -170,8 +166,7 @@ void vdc_request_generic_cb(dsvdc_t *handle __attribute__((unused)), char *dsuid
           scene_data->sanariumSelected = false;
           scene_data->irSelected = false;
           scene_data->selectedSaunaTemperature = 80;
-          klafs_change_mode(scene_data);
-          klafs_change_temperature(scene_data);
+          klafs_change_configuration(scene_data, KLAFS_CHANGE_MODE | KLAFS_CHANGE_TEMPERATURE);
           //klafs_power_on();  
         } else if(strcasecmp(id, "ActAfterFitnessSauna") == 0) {
           vdc_report(LOG_DEBUG, "Exec Program FitnessSauna command");
@@ -179,8 +174,7 @@ void vdc_request_generic_cb(dsvdc_t *handle __attribute__((unused)), char *dsuid
           scene_data->sanariumSelected = false;
           scene_data->irSelected = false;
           scene_data->selectedSaunaTemperature = 85;
-          klafs_change_mode(scene_data);
-          klafs_change_temperature(scene_data);
+          klafs_change_configuration(scene_data, KLAFS_CHANGE_MODE | KLAFS_CHANGE_TEMPERATURE);
           klafs_power_on();    
         } else if(strcasecmp(id, "ActClassicSauna") == 0) {
           vdc_report(LOG_DEBUG, "Exec Program ClassicSauna command");
@@ -188,8 +182,7 @@ void vdc_request_generic_cb(dsvdc_t *handle __attribute__((unused)), char *dsuid
           scene_data->sanariumSelected = false;
           scene_data->irSelected = false;
           scene_data->selectedSaunaTemperature = 90;
-          klafs_change_mode(scene_data);
-          klafs_change_temperature(scene_data);
+          klafs_change_configuration(scene_data, KLAFS_CHANGE_MODE | KLAFS_CHANGE_TEMPERATURE);
           klafs_power_on();    
         } else if(strcasecmp(id, "ActSoftSauna") == 0) {
           vdc_report(LOG_DEBUG, "Exec Program SoftSauna command");
@@ -197,8 +190,7 @@ void vdc_request_generic_cb(dsvdc_t *handle __attribute__((unused)), char *dsuid
           scene_data->sanariumSelected = false;
           scene_data->irSelected = false;
           scene_data->selectedSaunaTemperature = 65;
-          klafs_change_mode(scene_data);
-          klafs_change_temperature(scene_data);
+          klafs_change_configuration(scene_data, KLAFS_CHANGE_MODE | KLAFS_CHANGE_TEMPERATURE);
           klafs_power_on();      
         } else if(strcasecmp(id, "ActSummerSaunaSoft") == 0) {
           vdc_report(LOG_DEBUG, "Exec Program SommerSaunaSoft command");
@@ -206,101 +198,86 @@ void vdc_request_generic_cb(dsvdc_t *handle __attribute__((unused)), char *dsuid
           scene_data->sanariumSelected = false;
           scene_data->irSelected = false;
           scene_data->selectedSaunaTemperature = 70;
-          klafs_change_mode(scene_data);
-          klafs_change_temperature(scene_data);
+          klafs_change_configuration(scene_data, KLAFS_CHANGE_MODE | KLAFS_CHANGE_TEMPERATURE);
           klafs_power_on();      
         } else if(strcasecmp(id, "ActRelaxSanarium") == 0) {
           vdc_report(LOG_DEBUG, "Exec Program RelaxSanarium command");
           scene_data->saunaSelected = false;
           scene_data->sanariumSelected = true;
           scene_data->irSelected = false;
-          scene_data->selectedSaunaTemperature = 50;
+          scene_data->selectedSanariumTemperature = 50;
           scene_data->selectedHumLevel = 4;
-          klafs_change_mode(scene_data);
-          klafs_change_temperature(scene_data);
-          klafs_change_humidity(scene_data);
+          klafs_change_configuration(scene_data, KLAFS_CHANGE_MODE | KLAFS_CHANGE_TEMPERATURE | KLAFS_CHANGE_HUMIDITY);
           klafs_power_on();        
         } else if(strcasecmp(id, "ActBeautySanarium") == 0) {
           vdc_report(LOG_DEBUG, "Exec Program BeautySanarium command");
           scene_data->saunaSelected = false;
           scene_data->sanariumSelected = true;
           scene_data->irSelected = false;
-          scene_data->selectedSaunaTemperature = 55;
+          scene_data->selectedSanariumTemperature = 55;
           scene_data->selectedHumLevel = 8;
-          klafs_change_mode(scene_data);
-          klafs_change_temperature(scene_data);
-          klafs_change_humidity(scene_data);
+          klafs_change_configuration(scene_data, KLAFS_CHANGE_MODE | KLAFS_CHANGE_TEMPERATURE | KLAFS_CHANGE_HUMIDITY);
           klafs_power_on();          
         } else if(strcasecmp(id, "ActFamilySanarium") == 0) {
           vdc_report(LOG_DEBUG, "Exec Program FamilySanarium command");
           scene_data->saunaSelected = false;
           scene_data->sanariumSelected = true;
           scene_data->irSelected = false;
-          scene_data->selectedSaunaTemperature = 50;
+          scene_data->selectedSanariumTemperature = 50;
           scene_data->selectedHumLevel = 8;
-          klafs_change_mode(scene_data);
-          klafs_change_temperature(scene_data);
-          klafs_change_humidity(scene_data);
+          klafs_change_configuration(scene_data, KLAFS_CHANGE_MODE | KLAFS_CHANGE_TEMPERATURE | KLAFS_CHANGE_HUMIDITY);
           klafs_power_on();            
         } else if(strcasecmp(id, "ActImmunPowerSanarium") == 0) {
           vdc_report(LOG_DEBUG, "Exec Program ImmunPowerSanarium command");
           scene_data->saunaSelected = false;
           scene_data->sanariumSelected = true;
           scene_data->irSelected = false;
-          scene_data->selectedSaunaTemperature = 50;
+          scene_data->selectedSanariumTemperature = 50;
           scene_data->selectedHumLevel = 6;
-          klafs_change_mode(scene_data);
-          klafs_change_temperature(scene_data);
-          klafs_change_humidity(scene_data);
+          klafs_change_configuration(scene_data, KLAFS_CHANGE_MODE | KLAFS_CHANGE_TEMPERATURE | KLAFS_CHANGE_HUMIDITY);
           klafs_power_on();              
         } else if(strcasecmp(id, "ActVitalSanarium") == 0) {
           vdc_report(LOG_DEBUG, "Exec Program VitalPowerSanarium command");
           scene_data->saunaSelected = false;
           scene_data->sanariumSelected = true;
           scene_data->irSelected = false;
-          scene_data->selectedSaunaTemperature = 45;
+          scene_data->selectedSanariumTemperature = 45;
           scene_data->selectedHumLevel = 6;
-          klafs_change_mode(scene_data);
-          klafs_change_temperature(scene_data);
-          klafs_change_humidity(scene_data);
+          klafs_change_configuration(scene_data, KLAFS_CHANGE_MODE | KLAFS_CHANGE_TEMPERATURE | KLAFS_CHANGE_HUMIDITY);
           klafs_power_on();                
         } else if(strcasecmp(id, "ActTropenSanarium") == 0) {
           vdc_report(LOG_DEBUG, "Exec Program TropenSanarium command");
           scene_data->saunaSelected = false;
           scene_data->sanariumSelected = true;
           scene_data->irSelected = false;
-          scene_data->selectedSaunaTemperature = 60;
+          scene_data->selectedSanariumTemperature = 60;
           scene_data->selectedHumLevel = 10;
-          klafs_change_mode(scene_data);
-          klafs_change_temperature(scene_data);
-          klafs_change_humidity(scene_data);
+          klafs_change_configuration(scene_data, KLAFS_CHANGE_MODE | KLAFS_CHANGE_TEMPERATURE | KLAFS_CHANGE_HUMIDITY);
           klafs_power_on();                  
         } else if(strcasecmp(id, "ActSubtropenSanarium") == 0) {
           vdc_report(LOG_DEBUG, "Exec Program SubtropenSanarium command");
           scene_data->saunaSelected = false;
           scene_data->sanariumSelected = true;
           scene_data->irSelected = false;
-          scene_data->selectedSaunaTemperature = 60;
+          scene_data->selectedSanariumTemperature = 60;
           scene_data->selectedHumLevel = 8;
-          klafs_change_mode(scene_data);
-          klafs_change_temperature(scene_data);
-          klafs_change_humidity(scene_data);
+          klafs_change_configuration(scene_data, KLAFS_CHANGE_MODE | KLAFS_CHANGE_TEMPERATURE | KLAFS_CHANGE_HUMIDITY);
           klafs_power_on();                    
         } else if(strcasecmp(id, "ActFitnessSanarium") == 0) {
           vdc_report(LOG_DEBUG, "Exec Program FitnessSanarium command");
           scene_data->saunaSelected = false;
           scene_data->sanariumSelected = true;
           scene_data->irSelected = false;
-          scene_data->selectedSaunaTemperature = 55;
+          scene_data->selectedSanariumTemperature = 55;
           scene_data->selectedHumLevel = 10;
-          klafs_change_mode(scene_data);
-          klafs_change_temperature(scene_data);
-          klafs_change_humidity(scene_data);
+          klafs_change_configuration(scene_data, KLAFS_CHANGE_MODE | KLAFS_CHANGE_TEMPERATURE | KLAFS_CHANGE_HUMIDITY);
           klafs_power_on();                      
         } else {
           vdc_report(LOG_NOTICE, "request_generic_cb: command = %s not implemented\n", id);
         }
+        free(id);
       }
+      free(name);
     }      
   }
 }
@@ -310,7 +287,7 @@ void vdc_savescene_cb(dsvdc_t *handle __attribute__((unused)), char **dsuid, siz
   if (strcasecmp(sauna_device->dsuidstring, *dsuid) == 0) {
     klafs_get_values();
     save_scene(scene);
-    write_config();
+    write_config_deferred();
   }
 }
   
@@ -329,13 +306,17 @@ void vdc_callscene_cb(dsvdc_t *handle __attribute__((unused)), char **dsuid, siz
       if (scene_data != NULL) {
         if (!scene_data->isPoweredOn) {
           vdc_report(LOG_DEBUG, "handling a power OFF scene!\n");
+          schedule_cancel();
           klafs_power_off();
+        } else if (scene_data->timeSelected) {
+          vdc_report(LOG_DEBUG, "handling a timed power ON scene!\n");
+          schedule_start(scene_data);
         } else {
           vdc_report(LOG_DEBUG, "handling a power ON scene!\n");
-          klafs_change_favoriteprogram(scene_data);
+          schedule_cancel();
+          klafs_change_configuration(scene_data, KLAFS_CHANGE_ALL);
           klafs_power_on();          
         }  
-        free(scene_data);
       } else {
           vdc_report(LOG_INFO, "memory allocation for scene data failed!");
       }        
@@ -345,6 +326,498 @@ void vdc_callscene_cb(dsvdc_t *handle __attribute__((unused)), char **dsuid, siz
   }
 }
 
+dsvdc_property_t* create_action_property(char *id, char *title, char* description) {
+  dsvdc_property_t *nProp;
+  if (dsvdc_property_new(&nProp) != DSVDC_OK) {
+    vdc_report(LOG_ERR, "failed to allocate reply property");
+    return NULL;
+  }
+               
+  dsvdc_property_add_string (nProp, "id", id);
+  dsvdc_property_add_string (nProp, "action", id);
+  dsvdc_property_add_string (nProp, "title", title);
+  dsvdc_property_add_string (nProp, "description", description);
+  
+  return nProp;
+}
+
+/*
+ * Property handlers, looked up by name in the perfect hash tables generated
+ * by gperf from vdcprops.gperf and devprops.gperf. They are called with the
+ * identity cache read lock held; handlers of live sensor state take
+ * g_network_mutex themselves.
+ */
+
+typedef void (*vdc_getprop_handler_t)(dsvdc_property_t *property, const dsvdc_property_t *query, size_t index, const char *name);
+typedef uint8_t (*vdc_setprop_handler_t)(const dsvdc_property_t *properties, size_t index, const char *name);
+
+struct vdc_property_handler {
+  const char *name;
+  vdc_getprop_handler_t get;
+  vdc_setprop_handler_t set;
+  bool explicit_only;
+};
+
+static dsvdc_property_t* vdc_new_reply(const char *name) {
+  dsvdc_property_t *reply;
+  if (dsvdc_property_new(&reply) != DSVDC_OK) {
+    vdc_report(LOG_ERR, "failed to allocate reply property for %s\n", name);
+    return NULL;
+  }
+  return reply;
+}
+
+/* known property without a value */
+static void vdc_get_none(dsvdc_property_t *property, const dsvdc_property_t *query, size_t index, const char *name) {
+}
+
+static uint8_t vdc_set_zone_id(const dsvdc_property_t *properties, size_t index, const char *name) {
+  uint64_t zoneID;
+  if (dsvdc_property_get_uint(properties, index, &zoneID) != DSVDC_OK) {
+    vdc_report(LOG_ERR, "setprop_cb: error getting property value from property %s\n", name);
+    return DSVDC_ERR_INVALID_VALUE_TYPE;
+  }
+  vdc_report(LOG_NOTICE, "setprop_cb: \"%s\" = %d\n", name, zoneID);
+  g_default_zoneID = zoneID;
+  return DSVDC_OK;
+}
+
+static uint8_t vdsd_set_zone_id(const dsvdc_property_t *properties, size_t index, const char *name) {
+  uint64_t zoneID;
+  if (dsvdc_property_get_uint(properties, index, &zoneID) != DSVDC_OK) {
+    vdc_report(LOG_ERR, "setprop_cb: error getting property value from property %s\n", name);
+    return DSVDC_ERR_INVALID_VALUE_TYPE;
+  }
+  vdc_report(LOG_NOTICE, "setprop_cb: \"%s\" = %d\n", name, zoneID);
+  sauna_device->sauna->zoneID = zoneID;
+  return DSVDC_OK;
+}
+
+/*
+ * vDC properties
+ */
+
+static void vdc_get_display_id(dsvdc_property_t *property, const dsvdc_property_t *query, size_t index, const char *name) {
+  dsvdc_property_add_string(property, name, g_identity->vdc_display_id);
+}
+
+static void vdc_get_hardware_guid(dsvdc_property_t *property, const dsvdc_property_t *query, size_t index, const char *name) {
+  dsvdc_property_add_string(property, name, g_identity->vdc_hardware_guid);
+}
+
+static void vdc_get_implementation_id(dsvdc_property_t *property, const dsvdc_property_t *query, size_t index, const char *name) {
+  dsvdc_property_add_string(property, name, "Klafs Sauna");
+}
+
+static void vdc_get_name(dsvdc_property_t *property, const dsvdc_property_t *query, size_t index, const char *name) {
+  dsvdc_property_add_string(property, name, g_identity->vdc_name);
+}
+
+static void vdc_get_model(dsvdc_property_t *property, const dsvdc_property_t *query, size_t index, const char *name) {
+  dsvdc_property_add_string(property, name, g_identity->vdc_model);
+}
+
+static void vdc_get_capabilities(dsvdc_property_t *property, const dsvdc_property_t *query, size_t index, const char *name) {
+  dsvdc_property_t *reply = vdc_new_reply(name);
+  if (reply == NULL) {
+    return;
+  }
+  dsvdc_property_add_bool(reply, "metering", false);
+  dsvdc_property_add_bool(reply, "dynamicDefinitions", true);
+  dsvdc_property_add_property(property, name, &reply);
+}
+
+static void vdc_get_zone_id(dsvdc_property_t *property, const dsvdc_property_t *query, size_t index, const char *name) {
+  dsvdc_property_add_uint(property, "zoneID", g_identity->vdc_zone_id);
+}
+
+static void vdc_get_statistics(dsvdc_property_t *property, const dsvdc_property_t *query, size_t index, const char *name) {
+  dsvdc_property_t *reply = vdc_new_reply(name);
+  if (reply == NULL) {
+    return;
+  }
+  dsvdc_property_add_uint(reply, "polls", g_stats.polls);
+  dsvdc_property_add_uint(reply, "pollsUnchanged", g_stats.polls_unchanged);
+  dsvdc_property_add_uint(reply, "bytesReceived", g_stats.bytes_received);
+  dsvdc_property_add_uint(reply, "bytesDecoded", g_stats.bytes_decoded);
+  dsvdc_property_add_uint(reply, "pushRequests", g_stats.push_requests);
+  dsvdc_property_add_uint(reply, "pushes", g_stats.pushes);
+  dsvdc_property_add_uint(reply, "timersFired", g_stats.timers_fired);
+  dsvdc_property_add_uint(reply, "timerJitterAvgMs", g_stats.timers_fired > 0 ? g_stats.timer_jitter_total_ms / g_stats.timers_fired : 0);
+  dsvdc_property_add_uint(reply, "timerJitterMaxMs", g_stats.timer_jitter_max_ms);
+  alloc_add_property(reply);
+  dsvdc_property_add_property(property, name, &reply);
+}
+
+static void vdc_get_latency(dsvdc_property_t *property, const dsvdc_property_t *query, size_t index, const char *name) {
+  stall_add_property(property, name);
+}
+
+/*
+ * vdSD properties
+ */
+
+static void vdsd_get_primary_group(dsvdc_property_t *property, const dsvdc_property_t *query, size_t index, const char *name) {
+  dsvdc_property_add_uint(property, "primaryGroup", 9);
+}
+
+static void vdsd_get_zone_id(dsvdc_property_t *property, const dsvdc_property_t *query, size_t index, const char *name) {
+  dsvdc_property_add_uint(property, "zoneID", g_identity->zone_id);
+}
+
+static const struct {
+  const char *name;
+  const char *title;
+} g_dynamic_actions[] = {
+  { "ActTurnOn", "01-Starten" },
+  { "ActTurnOff", "02-Beenden" },
+  { "ActModeSauna", "03-Sauna wählen" },
+  { "ActModeSanarium", "04-Sanarium wählen" },
+  { "ActModeIR", "05-Infrarot wählen" },
+  { "ActSommerSaunaClassic", "06-Sommer Sauna Classic" },
+  { "ActChilloutSauna", "07-Chillout Sauna" },
+  { "ActAfterFitnessSauna", "08-After-Fitness Sauna" },
+  { "ActClassicSauna", "09-Classic Sauna" },
+  { "ActSoftSauna", "10-Soft Sauna" },
+  { "ActSummerSaunaSoft", "11-Sommer Sauna Soft" },
+  { "ActRelaxSanarium", "12-Relax Sanarium" },
+  { "ActBeautySanarium", "13-Beauty Sanarium" },
+  { "ActFamilySanarium", "14-Family Sanarium" },
+  { "ActImmunPowerSanarium", "15-Immun Power Sanarium" },
+  { "ActVitalSanarium", "16-Vital Sanarium" },
+  { "ActTropenSanarium", "17-Tropen Sanarium" },
+  { "ActSubtropenSanarium", "18-Subtropen Sanarium" },
+  { "ActFitnessSanarium", "19-Fitness Sanarium" },
+};
+
+static void vdsd_get_dynamic_actions(dsvdc_property_t *property, const dsvdc_property_t *query, size_t index, const char *name) {
+  dsvdc_property_t *reply = vdc_new_reply(name);
+  if (reply == NULL) {
+    return;
+  }
+
+  for (size_t i = 0; i < sizeof(g_dynamic_actions) / sizeof(g_dynamic_actions[0]); i++) {
+    char id[64];
+    snprintf(id, sizeof(id), "dynamic.%s", g_dynamic_actions[i].name);
+
+    dsvdc_property_t *nProp = create_action_property(id, (char *) g_dynamic_actions[i].title, (char *) g_dynamic_actions[i].title);
+    if (nProp == NULL) {
+      break;
+    }
+    dsvdc_property_add_property(reply, g_dynamic_actions[i].name, &nProp);
+  }
+
+  dsvdc_property_add_property(property, name, &reply);
+}
+
+static void vdsd_get_binary_input_descriptions(dsvdc_property_t *property, const dsvdc_property_t *query, size_t index, const char *name) {
+  dsvdc_property_t *reply = vdc_new_reply(name);
+  if (reply == NULL) {
+    return;
+  }
+
+  for (int i = 0; i < g_identity->binary_count; i++) {
+    const identity_binary_t *binary = &g_identity->binaries[i];
+
+    dsvdc_property_t *nProp;
+    if (dsvdc_property_new(&nProp) != DSVDC_OK) {
+      vdc_report(LOG_ERR, "failed to allocate reply property for %s/%s\n", name, binary->name);
+      break;
+    }
+
+    dsvdc_property_add_string(nProp, "name", binary->name);
+    dsvdc_property_add_uint(nProp, "inputType", 1);
+    dsvdc_property_add_uint(nProp, "inputUsage", 0);
+    dsvdc_property_add_uint(nProp, "sensorFunction", binary->sensor_function);
+    dsvdc_property_add_double(nProp, "updateInterval", 5);
+    dsvdc_property_add_property(reply, binary->key, &nProp);
+  }
+
+  dsvdc_property_add_property(property, name, &reply);
+}
+
+static void vdsd_get_binary_input_settings(dsvdc_property_t *property, const dsvdc_property_t *query, size_t index, const char *name) {
+  dsvdc_property_t *reply = vdc_new_reply(name);
+  if (reply == NULL) {
+    return;
+  }
+
+  for (int i = 0; i < g_identity->binary_count; i++) {
+    const identity_binary_t *binary = &g_identity->binaries[i];
+
+    dsvdc_property_t *nProp;
+    if (dsvdc_property_new(&nProp) != DSVDC_OK) {
+      vdc_report(LOG_ERR, "failed to allocate reply property for %s\n", name);
+      break;
+    }
+    dsvdc_property_add_uint(nProp, "group", 8);
+    dsvdc_property_add_uint(nProp, "sensorFunction", binary->sensor_function);
+    dsvdc_property_add_property(reply, binary->key, &nProp);
+  }
+  dsvdc_property_add_property(property, name, &reply);
+}
+
+static void vdsd_get_sensor_descriptions(dsvdc_property_t *property, const dsvdc_property_t *query, size_t index, const char *name) {
+  dsvdc_property_t *reply = vdc_new_reply(name);
+  if (reply == NULL) {
+    return;
+  }
+
+  for (int i = 0; i < g_identity->sensor_count; i++) {
+    const identity_sensor_t *sensor = &g_identity->sensors[i];
+
+    dsvdc_property_t *nProp;
+    if (dsvdc_property_new(&nProp) != DSVDC_OK) {
+      vdc_report(LOG_ERR, "failed to allocate reply property for %s/%s\n", name, sensor->name);
+      break;
+    }
+    dsvdc_property_add_string(nProp, "name", sensor->name);
+    dsvdc_property_add_uint(nProp, "sensorType", sensor->sensor_type);
+    dsvdc_property_add_uint(nProp, "sensorUsage", sensor->sensor_usage);
+    dsvdc_property_add_double(nProp, "aliveSignInterval", 300);
+    dsvdc_property_add_property(reply, sensor->key, &nProp);
+  }
+
+  dsvdc_property_add_property(property, name, &reply);
+}
+
+static void vdsd_get_sensor_settings(dsvdc_property_t *property, const dsvdc_property_t *query, size_t index, const char *name) {
+  dsvdc_property_t *reply = vdc_new_reply(name);
+  if (reply == NULL) {
+    return;
+  }
+
+  for (int i = 0; i < g_identity->sensor_count; i++) {
+    dsvdc_property_t *nProp;
+    if (dsvdc_property_new(&nProp) != DSVDC_OK) {
+      vdc_report(LOG_ERR, "failed to allocate reply property for %s\n", name);
+      break;
+    }
+    dsvdc_property_add_uint(nProp, "group", 8);
+    dsvdc_property_add_uint(nProp, "minPushInterval", 5);
+    dsvdc_property_add_double(nProp, "changesOnlyInterval", 5);
+    dsvdc_property_add_property(reply, g_identity->sensors[i].key, &nProp);
+  }
+  dsvdc_property_add_property(property, name, &reply);
+}
+
+#define VDSD_QUERY_ALL -1
+#define VDSD_QUERY_NONE -2
+
+/* returns the state index selected by the sub element of query element index,
+ * VDSD_QUERY_ALL without a selection or VDSD_QUERY_NONE if it is not a valid index
+ */
+static int vdsd_query_index(const dsvdc_property_t *query, size_t index, const char *name) {
+  int idx = VDSD_QUERY_ALL;
+  char* sensorIndex;
+  dsvdc_property_t *sensorRequest;
+
+  if (dsvdc_property_get_property_by_index(query, index, &sensorRequest) != DSVDC_OK) {
+    return VDSD_QUERY_ALL;
+  }
+  if (dsvdc_property_get_name(sensorRequest, 0, &sensorIndex) != DSVDC_OK || sensorIndex == NULL) {
+    vdc_report(LOG_DEBUG, "%s: no index in request\n", name);
+  } else {
+    char *end;
+    long value = strtol(sensorIndex, &end, 10);
+    idx = (end != sensorIndex && *end == 0 && value >= 0 && value < 256) ? (int) value : VDSD_QUERY_NONE;
+    free(sensorIndex);
+  }
+  dsvdc_property_free(sensorRequest);
+  return idx;
+}
+
+/* must be called with g_network_mutex held */
+static void vdsd_add_sensor_state(dsvdc_property_t *reply, int i, time_t now) {
+  dsvdc_property_t *nProp;
+  if (dsvdc_property_new(&nProp) != DSVDC_OK) {
+    vdc_report(LOG_ERR, "failed to allocate reply property for sensorStates\n");
+    return;
+  }
+
+  dsvdc_property_add_double(nProp, "value", sauna_device->sauna->sensor_values[i].value);
+  dsvdc_property_add_int(nProp, "age", now - sauna_device->sauna->sensor_values[i].last_query);
+  dsvdc_property_add_int(nProp, "error", 0);
+  dsvdc_property_add_property(reply, g_identity->sensors[i].key, &nProp);
+}
+
+/* must be called with g_network_mutex held */
+static void vdsd_add_binary_input_state(dsvdc_property_t *reply, int i, time_t now) {
+  dsvdc_property_t *nProp;
+  if (dsvdc_property_new(&nProp) != DSVDC_OK) {
+    vdc_report(LOG_ERR, "failed to allocate reply property for binaryInputStates\n");
+    return;
+  }
+
+  dsvdc_property_add_bool(nProp, "value",  sauna_device->sauna->binary_values[i].value);
+  dsvdc_property_add_int(nProp, "age", now - sauna_device->sauna->binary_values[i].last_query);
+  dsvdc_property_add_int(nProp, "error", 0);
+  dsvdc_property_add_property(reply, g_identity->binaries[i].key, &nProp);
+}
+
+/* a single selected index is answered directly, the index keys are taken from the identity cache */
+static void vdsd_get_sensor_states(dsvdc_property_t *property, const dsvdc_property_t *query, size_t index, const char *name) {
+  dsvdc_property_t *reply = vdc_new_reply(name);
+  if (reply == NULL) {
+    return;
+  }
+
+  int idx = vdsd_query_index(query, index, name);
+  time_t now = time(NULL);
+
+  pthread_mutex_lock(&g_network_mutex);
+  int count = sauna_device->sauna->sensor_count < g_identity->sensor_count ? sauna_device->sauna->sensor_count : g_identity->sensor_count;
+  if (idx == VDSD_QUERY_ALL) {
+    for (int i = 0; i < count; i++) {
+      vdsd_add_sensor_state(reply, i, now);
+    }
+  } else if (idx >= 0 && idx < count) {
+    vdsd_add_sensor_state(reply, idx, now);
+  }
+  pthread_mutex_unlock(&g_network_mutex);
+  dsvdc_property_add_property(property, name, &reply);
+}
+
+static void vdsd_get_binary_input_states(dsvdc_property_t *property, const dsvdc_property_t *query, size_t index, const char *name) {
+  dsvdc_property_t *reply = vdc_new_reply(name);
+  if (reply == NULL) {
+    return;
+  }
+
+  int idx = vdsd_query_index(query, index, name);
+  time_t now = time(NULL);
+
+  pthread_mutex_lock(&g_network_mutex);
+  int count = sauna_device->sauna->binary_count < g_identity->binary_count ? sauna_device->sauna->binary_count : g_identity->binary_count;
+  if (idx == VDSD_QUERY_ALL) {
+    for (int i = 0; i < count; i++) {
+      vdsd_add_binary_input_state(reply, i, now);
+    }
+  } else if (idx >= 0 && idx < count) {
+    vdsd_add_binary_input_state(reply, idx, now);
+  }
+  pthread_mutex_unlock(&g_network_mutex);
+  dsvdc_property_add_property(property, name, &reply);
+}
+
+static void vdsd_get_sensor_history(dsvdc_property_t *property, const dsvdc_property_t *query, size_t index, const char *name) {
+  dsvdc_property_t *reply = vdc_new_reply(name);
+  if (reply == NULL) {
+    return;
+  }
+
+  // optional sub element selects a single sensor, either by index or by value name
+  char* sensorKey = NULL;
+  dsvdc_property_t *historyRequest;
+  if (dsvdc_property_get_property_by_index(query, index, &historyRequest) == DSVDC_OK) {
+    if (dsvdc_property_get_name(historyRequest, 0, &sensorKey) != DSVDC_OK) {
+      sensorKey = NULL;
+    }
+    dsvdc_property_free(historyRequest);
+  }
+
+  pthread_mutex_lock(&g_network_mutex);
+  for (int i = 0; i < sauna_device->sauna->sensor_count && i < g_identity->sensor_count; i++) {
+    sensor_value_t *value = &sauna_device->sauna->sensor_values[i];
+    const char *sensorIndex = g_identity->sensors[i].key;
+
+    if (sensorKey == NULL || strcmp(sensorKey, sensorIndex) == 0 || strcasecmp(sensorKey, value->value_name) == 0) {
+      sensor_history_add_property(reply, sensorIndex, value);
+    }
+  }
+  pthread_mutex_unlock(&g_network_mutex);
+  free(sensorKey);
+
+  dsvdc_property_add_property(property, name, &reply);
+}
+
+static void vdsd_get_name(dsvdc_property_t *property, const dsvdc_property_t *query, size_t index, const char *name) {
+  dsvdc_property_add_string(property, name, g_identity->name);
+}
+
+static void vdsd_get_type(dsvdc_property_t *property, const dsvdc_property_t *query, size_t index, const char *name) {
+  dsvdc_property_add_string(property, name, "vDSD");
+}
+
+static void vdsd_get_model(dsvdc_property_t *property, const dsvdc_property_t *query, size_t index, const char *name) {
+  dsvdc_property_add_string(property, name, "Sauna");
+}
+
+static void vdsd_get_model_features(dsvdc_property_t *property, const dsvdc_property_t *query, size_t index, const char *name) {
+  dsvdc_property_t *nProp = vdc_new_reply(name);
+  if (nProp == NULL) {
+    return;
+  }
+  dsvdc_property_add_bool(nProp, "dontcare", false);
+  dsvdc_property_add_bool(nProp, "blink", false);
+  dsvdc_property_add_bool(nProp, "outmode", false);
+  dsvdc_property_add_bool(nProp, "jokerconfig", true);
+  dsvdc_property_add_property(property, name, &nProp);
+}
+
+static void vdsd_get_model_uid(dsvdc_property_t *property, const dsvdc_property_t *query, size_t index, const char *name) {
+  dsvdc_property_add_string(property, name, "Klafs Sauna");
+}
+
+static void vdsd_get_model_version(dsvdc_property_t *property, const dsvdc_property_t *query, size_t index, const char *name) {
+  dsvdc_property_add_string(property, name, "0");
+}
+
+static void vdsd_get_vendor_id(dsvdc_property_t *property, const dsvdc_property_t *query, size_t index, const char *name) {
+  dsvdc_property_add_string(property, name, "vendor: Klafs");
+}
+
+static void vdsd_get_vendor_name(dsvdc_property_t *property, const dsvdc_property_t *query, size_t index, const char *name) {
+  dsvdc_property_add_string(property, name, "Klafs");
+}
+
+static void vdsd_get_vendor_guid(dsvdc_property_t *property, const dsvdc_property_t *query, size_t index, const char *name) {
+  dsvdc_property_add_string(property, name, g_identity->vendor_guid);
+}
+
+static void vdsd_get_hardware_version(dsvdc_property_t *property, const dsvdc_property_t *query, size_t index, const char *name) {
+  dsvdc_property_add_string(property, name, "0.0.0");
+}
+
+static void vdsd_get_empty_string(dsvdc_property_t *property, const dsvdc_property_t *query, size_t index, const char *name) {
+  dsvdc_property_add_string(property, name, "");
+}
+
+static void vdsd_get_icon16(dsvdc_property_t *property, const dsvdc_property_t *query, size_t index, const char *name) {
+  dsvdc_property_add_bytes(property, name, gIconStation16Data, gIconStation16Size);
+}
+
+static void vdsd_get_icon48(dsvdc_property_t *property, const dsvdc_property_t *query, size_t index, const char *name) {
+  dsvdc_property_add_bytes(property, name, gIconStation48Data, gIconStation48Size);
+}
+
+static void vdsd_get_icon_name(dsvdc_property_t *property, const dsvdc_property_t *query, size_t index, const char *name) {
+  dsvdc_property_add_string(property, name, "klafs-sauna-16.png");
+}
+
+/* generated lookup functions vdc_property_lookup() and vdsd_property_lookup(),
+ * the word arrays g_vdc_properties and g_vdsd_properties hold all handlers
+ */
+#include "vdcprops.h"
+#undef TOTAL_KEYWORDS
+#undef MIN_WORD_LENGTH
+#undef MAX_WORD_LENGTH
+#undef MIN_HASH_VALUE
+#undef MAX_HASH_VALUE
+#include "devprops.h"
+
+/* wildcard query: answers every property of the table except the large explicit
+ * only ones, which dSS would otherwise receive on every (re)discovery; empty hash
+ * slots have no name
+ */
+static void vdc_get_all(const struct vdc_property_handler *table, size_t count, dsvdc_property_t *property, const dsvdc_property_t *query, size_t index) {
+  for (size_t n = 0; n < count; n++) {
+    if (table[n].name != NULL && table[n].get != NULL && !table[n].explicit_only) {
+      table[n].get(property, query, index, table[n].name);
+    }
+  }
+}
+
 void vdc_setprop_cb(dsvdc_t *handle, const char *dsuid, dsvdc_property_t *property, const dsvdc_property_t *properties, void *userdata) {
   (void) userdata;
   int ret;
@@ -372,34 +845,29 @@ void vdc_setprop_cb(dsvdc_t *handle, const char *dsuid, dsvdc_property_t *proper
 
       vdc_report(LOG_INFO, "set request for name=\"%s\"\n", name);
 
-      if (strcmp(name, "zoneID") == 0) {
-        uint64_t zoneID;
-        ret = dsvdc_property_get_uint(properties, i, &zoneID);
-        if (ret != DSVDC_OK) {
-          vdc_report(LOG_ERR, "setprop_cb: error getting property value from property %s\n", name);
-          code = DSVDC_ERR_INVALID_VALUE_TYPE;
-          break;
-        }
-        vdc_report(LOG_NOTICE, "setprop_cb: \"%s\" = %d\n", name, zoneID);
-        g_default_zoneID = zoneID;
-        code = DSVDC_OK;
-      } else {
+      const struct vdc_property_handler *handler = vdc_property_lookup(name, strlen(name));
+      if (handler == NULL || handler->set == NULL) {
+        free(name);
         code = DSVDC_ERR_NOT_FOUND;
         break;
       }
-
+      code = handler->set(properties, i, name);
       free(name);
+      if (code != DSVDC_OK) {
+        break;
+      }
     }
 
     if (code == DSVDC_OK) {
-      write_config();
+      write_config_deferred();
+      identity_rebuild();
     }
 
     dsvdc_send_set_property_response(handle, property, code);
     return;
-  } 
-  
-  if (strcasecmp(sauna_device->dsuidstring, dsuid) != 0) {	  
+  }
+
+  if (strcasecmp(sauna_device->dsuidstring, dsuid) != 0) {
     vdc_report(LOG_WARNING, "set property: unhandled dsuid %s\n", dsuid);
     dsvdc_property_free(property);
     return;
@@ -408,6 +876,7 @@ void vdc_setprop_cb(dsvdc_t *handle, const char *dsuid, dsvdc_property_t *proper
   /*
    * Properties for the VDSD's
    */
+  bool changed = false;
   pthread_mutex_lock(&g_network_mutex);
   for (i = 0; i < dsvdc_property_get_num_properties(properties); i++) {
     char *name;
@@ -424,141 +893,69 @@ void vdc_setprop_cb(dsvdc_t *handle, const char *dsuid, dsvdc_property_t *proper
       //dsvdc_send_property_response(handle, property);
       continue;
     }
-    vdc_report(LOG_NOTICE, "get request name!!=\"%s\"\n", name);
-
-    if (strcmp(name, "zoneID") == 0) {
-      uint64_t zoneID;
-      ret = dsvdc_property_get_uint(properties, i, &zoneID);
-      if (ret != DSVDC_OK) {
-        vdc_report(LOG_ERR, "setprop_cb: error getting property value from property %s\n", name);
-        code = DSVDC_ERR_INVALID_VALUE_TYPE;
-        break;
-      }
-      vdc_report(LOG_NOTICE, "setprop_cb: \"%s\" = %d\n", name, zoneID);
-      sauna_device->sauna->zoneID = zoneID;
-      code = DSVDC_OK;
-    } else {
-      code = DSVDC_OK;
+    vdc_report(LOG_NOTICE, "set request name=\"%s\"\n", name);
+
+    /* unknown properties are accepted and ignored */
+    const struct vdc_property_handler *handler = vdsd_property_lookup(name, strlen(name));
+    code = DSVDC_OK;
+    if (handler != NULL && handler->set != NULL) {
+      code = handler->set(properties, i, name);
+      changed = true;
     }
-      
-
     free(name);
+    if (code != DSVDC_OK) {
+      break;
+    }
   }
   pthread_mutex_unlock(&g_network_mutex);
 
-  dsvdc_send_set_property_response(handle, property, code);
-}
-
-dsvdc_property_t* create_action_property(char *id, char *title, char* description) {
-  dsvdc_property_t *nProp;
-  if (dsvdc_property_new(&nProp) != DSVDC_OK) {
-    vdc_report(LOG_ERR, "failed to allocate reply property");
-    return NULL;
+  if (changed && code == DSVDC_OK) {
+    identity_rebuild();
   }
-               
-  dsvdc_property_add_string (nProp, "id", id);
-  dsvdc_property_add_string (nProp, "action", id);
-  dsvdc_property_add_string (nProp, "title", title);
-  dsvdc_property_add_string (nProp, "description", description);
-  
-  return nProp;
+
+  dsvdc_send_set_property_response(handle, property, code);
 }
 
 void vdc_getprop_cb(dsvdc_t *handle, const char *dsuid, dsvdc_property_t *property, const dsvdc_property_t *query, void *userdata) {
   (void) userdata;
-  int ret;
   size_t i;
   char *name;
-  
+
   vdc_report(LOG_INFO, "get property for dsuid: %s\n", dsuid);
 
   /*
    * Properties for the VDC
    */
   if (strcasecmp(g_vdc_dsuid, dsuid) == 0) {
-    for (i = 0; i < dsvdc_property_get_num_properties(query); i++) {
+    identity_read_lock();
+    for (i = 0; g_identity != NULL && i < dsvdc_property_get_num_properties(query); i++) {
 
       int ret = dsvdc_property_get_name(query, i, &name);
       if (ret != DSVDC_OK) {
         vdc_report(LOG_ERR, "getprop_cb: error getting property name, abort\n");
-        dsvdc_send_get_property_response(handle, property);
-        return;
+        break;
       }
       if (!name) {
-        vdc_report(LOG_ERR, "getprop_cb: not yet handling wildcard properties\n");
-        dsvdc_send_get_property_response(handle, property);
-        return;
+        vdc_report(LOG_INFO, "get request for all vDC properties\n");
+        vdc_get_all(g_vdc_properties, sizeof(g_vdc_properties) / sizeof(g_vdc_properties[0]), property, query, i);
+        continue;
       }
       vdc_report(LOG_NOTICE, "get request name=\"%s\"\n", name);
 
-      if ((strcmp(name, "hardwareGuid") == 0) || (strcmp(name, "displayId") == 0)) {
-        char info[256];
-        char buffer[32];
-        size_t n;
-
-        memset(info, 0, sizeof(info));
-        if (strcmp(name, "hardwareGuid") == 0) {
-          strcpy(info, "sauna-id:");
-        }
-        sprintf(buffer, "%d", klafs.sauna.id);
-        strcat(info, buffer);
-        dsvdc_property_add_string(property, name, info);
-
-      } else if (strcmp(name, "vendorId") == 0) {
-      } else if (strcmp(name, "oemGuid") == 0) {
-
-      } else if (strcmp(name, "implementationId") == 0) {
-        dsvdc_property_add_string(property, name, "Klafs Sauna");
-
-      } else if (strcmp(name, "modelUID") == 0) {
-        dsvdc_property_add_string(property, name, "Klafs Sauna");
-
-      } else if (strcmp(name, "modelGuid") == 0) {
-        dsvdc_property_add_string(property, name, "Klafs Sauna");
-
-      } else if (strcmp(name, "name") == 0) {
-        char info[256];
-        strcpy(info, "Klafs Sauna ");
-        strcat(info, klafs.sauna.name);
-        dsvdc_property_add_string(property, name, info);
-
-      } else if (strcmp(name, "model") == 0) {
-        char hostname[HOST_NAME_MAX];
-        gethostname(hostname, HOST_NAME_MAX);
-        char servicename[HOST_NAME_MAX + 32];
-        strcpy(servicename, "Klafs Sauna Controller @");
-        strcat(servicename, hostname);
-        dsvdc_property_add_string(property, name, servicename);
-
-      } else if (strcmp(name, "capabilities") == 0) {
-        dsvdc_property_t *reply;
-        ret = dsvdc_property_new(&reply);
-        if (ret != DSVDC_OK) {
-          vdc_report(LOG_ERR, "failed to allocate reply property for %s\n", name);
-          free(name);
-          continue;
-        }
-        dsvdc_property_add_bool(reply, "metering", false);
-        dsvdc_property_add_bool(reply, "dynamicDefinitions", true);
-        dsvdc_property_add_property(property, name, &reply);
-
-      } else if (strcmp(name, "configURL") == 0) {
-
-
-      } else if (strcmp(name, "zoneID") == 0) {
-        dsvdc_property_add_uint(property, "zoneID", g_default_zoneID);
-
       /* user properties: user name, client_id, status */
-
+      const struct vdc_property_handler *handler = vdc_property_lookup(name, strlen(name));
+      if (handler != NULL && handler->get != NULL) {
+        handler->get(property, query, i, name);
       }
       free(name);
     }
+    identity_read_unlock();
 
     dsvdc_send_get_property_response(handle, property);
     return;
-  } 
+  }
 
-  if (strcasecmp(sauna_device->dsuidstring, dsuid) != 0) {	  
+  if (strcasecmp(sauna_device->dsuidstring, dsuid) != 0) {
     vdc_report(LOG_WARNING, "get property: unhandled dsuid %s\n", dsuid);
     dsvdc_property_free(property);
     return;
@@ -567,466 +964,31 @@ void vdc_getprop_cb(dsvdc_t *handle, const char *dsuid, dsvdc_property_t *proper
   /*
    * Properties for the VDSD's
    */
-  pthread_mutex_lock(&g_network_mutex);
-  for (i = 0; i < dsvdc_property_get_num_properties(query); i++) {
+  identity_read_lock();
+  for (i = 0; g_identity != NULL && i < dsvdc_property_get_num_properties(query); i++) {
 
     int ret = dsvdc_property_get_name(query, i, &name);
     if (ret != DSVDC_OK) {
       vdc_report(LOG_ERR, "getprop_cb: error getting property name, abort\n");
-      dsvdc_send_get_property_response(handle, property);
-      pthread_mutex_unlock(&g_network_mutex);
-      return;
+      break;
     }
     if (!name) {
-      vdc_report(LOG_ERR, "getprop_cb: not yet handling wildcard properties\n");
-      //dsvdc_send_property_response(handle, property);
+      vdc_report(LOG_INFO, "get request for all vdSD properties\n");
+      vdc_get_all(g_vdsd_properties, sizeof(g_vdsd_properties) / sizeof(g_vdsd_properties[0]), property, query, i);
       continue;
     }
     vdc_report(LOG_NOTICE, "get request name=\"%s\"\n", name);
 
-    if (strcmp(name, "primaryGroup") == 0) {
-      dsvdc_property_add_uint(property, "primaryGroup", 9);
-    } else if (strcmp(name, "zoneID") == 0) {
-      dsvdc_property_add_uint(property, "zoneID", sauna_device->sauna->zoneID);
-    } else if (strcmp(name, "buttonInputDescriptions") == 0) {
-     
-
-    } else if (strcmp(name, "buttonInputSettings") == 0) {
-      
-    } else if (strcmp(name, "dynamicActionDescriptions") == 0) { 
-      dsvdc_property_t *reply;
-      ret = dsvdc_property_new(&reply);
-      if (ret != DSVDC_OK) {
-        vdc_report(LOG_ERR, "failed to allocate reply property for %s\n", name);
-        free(name);
-        continue;
-      }
-
-      int i = 0;
-      char propIndex[64];     
-      dsvdc_property_t *nProp;
-
-      nProp = create_action_property("dynamic.ActTurnOn", "01-Starten", "01-Starten");          
-      //snprintf(propIndex, 64, "%d", i++);
-      dsvdc_property_add_property(reply, "ActTurnOn", &nProp);
-      
-      nProp = create_action_property("dynamic.ActTurnOff", "02-Beenden", "02-Beenden");          
-      //snprintf(propIndex, 64, "%d", i++);
-      dsvdc_property_add_property(reply, "ActTurnOff", &nProp);
-      
-      nProp = create_action_property("dynamic.ActModeSauna", "03-Sauna wählen", "03-Sauna wählen");          
-      //snprintf(propIndex, 64, "%d", i++);
-      dsvdc_property_add_property(reply, "ActModeSauna", &nProp);
-      
-      nProp = create_action_property("dynamic.ActModeSanarium", "04-Sanarium wählen", "04-Sanarium wählen");          
-      //snprintf(propIndex, 64, "%d", i++);
-      dsvdc_property_add_property(reply, "ActModeSanarium", &nProp);
-      
-      nProp = create_action_property("dynamic.ActModeIR", "05-Infrarot wählen", "05-Infrarot wählen");          
-      //snprintf(propIndex, 64, "%d", i++);
-      dsvdc_property_add_property(reply, "ActModeIR", &nProp);
-      
-      nProp = create_action_property("dynamic.ActSommerSaunaClassic", "06-Sommer Sauna Classic", "06-Sommer Sauna Classic");          
-      //snprintf(propIndex, 64, "%d", i++);
-      dsvdc_property_add_property(reply, "ActSommerSaunaClassic", &nProp);
-      
-      nProp = create_action_property("dynamic.ActChilloutSauna", "07-Chillout Sauna", "07-Chillout Sauna");          
-      //snprintf(propIndex, 64, "%d", i++);
-      dsvdc_property_add_property(reply, "ActChilloutSauna", &nProp);
-      
-      nProp = create_action_property("dynamic.ActAfterFitnessSauna", "08-After-Fitness Sauna", "08-After-Fitness Sauna");          
-      //snprintf(propIndex, 64, "%d", i++);
-      dsvdc_property_add_property(reply, "ActAfterFitnessSauna", &nProp);
-      
-      nProp = create_action_property("dynamic.ActClassicSauna", "09-Classic Sauna", "09-Classic Sauna");          
-      //snprintf(propIndex, 64, "%d", i++);
-      dsvdc_property_add_property(reply, "ActClassicSauna", &nProp);
-      
-      nProp = create_action_property("dynamic.ActSoftSauna", "10-Soft Sauna", "10-Soft Sauna");          
-      //snprintf(propIndex, 64, "%d", i++);
-      dsvdc_property_add_property(reply, "ActSoftSauna", &nProp);
-      
-      nProp = create_action_property("dynamic.ActSummerSaunaSoft", "11-Sommer Sauna Soft", "11-Sommer Sauna Soft");          
-      //snprintf(propIndex, 64, "%d", i++);
-      dsvdc_property_add_property(reply, "ActSummerSaunaSoft", &nProp);
-      
-      nProp = create_action_property("dynamic.ActRelaxSanarium", "12-Relax Sanarium", "12-Relax Sanarium");          
-      //snprintf(propIndex, 64, "%d", i++);
-      dsvdc_property_add_property(reply, "ActRelaxSanarium", &nProp);
-      
-      nProp = create_action_property("dynamic.ActBeautySanarium", "13-Beauty Sanarium", "13-Beauty Sanarium");          
-      //snprintf(propIndex, 64, "%d", i++);
-      dsvdc_property_add_property(reply, "ActBeautySanarium", &nProp);
-            
-      nProp = create_action_property("dynamic.ActFamilySanarium", "14-Family Sanarium", "14-Family Sanarium");          
-      //snprintf(propIndex, 64, "%d", i++);
-      dsvdc_property_add_property(reply, "ActFamilySanarium", &nProp);
-      
-      nProp = create_action_property("dynamic.ActImmunPowerSanarium", "15-Immun Power Sanarium", "15-Immun Power Sanarium");          
-      //snprintf(propIndex, 64, "%d", i++);
-      dsvdc_property_add_property(reply, "ActImmunPowerSanarium", &nProp);
-      
-      nProp = create_action_property("dynamic.ActVitalSanarium", "16-Vital Sanarium", "16-Vital Sanarium");          
-      //snprintf(propIndex, 64, "%d", i++);
-      dsvdc_property_add_property(reply, "ActVitalSanarium", &nProp);
-           
-      nProp = create_action_property("dynamic.ActTropenSanarium", "17-Tropen Sanarium", "17-Tropen Sanarium");          
-      //snprintf(propIndex, 64, "%d", i++);
-      dsvdc_property_add_property(reply, "ActTropenSanarium", &nProp);
-      
-      nProp = create_action_property("dynamic.ActSubtropenSanarium", "18-Subtropen Sanarium", "18-Subtropen Sanarium");          
-      //snprintf(propIndex, 64, "%d", i++);
-      dsvdc_property_add_property(reply, "ActSubtropenSanarium", &nProp);
-      
-      nProp = create_action_property("dynamic.ActFitnessSanarium", "19-Fitness Sanarium", "19-Fitness Sanarium");          
-      //snprintf(propIndex, 64, "%d", i++);
-      dsvdc_property_add_property(reply, "ActFitnessSanarium", &nProp); 
-
-      dsvdc_property_add_property(property, name, &reply); 
-
-    } else if (strcmp(name, "outputDescription") == 0) {
-
-    } else if (strcmp(name, "outputSettings") == 0) {
-
-    } else if (strcmp(name, "channelDescriptions") == 0) {
-    } else if (strcmp(name, "channelSettings") == 0) {
-    } else if (strcmp(name, "channelStates") == 0) {
-    } else if (strcmp(name, "deviceStates") == 0) {
-      
-    } else if (strcmp(name, "deviceProperties") == 0) {
-      
-    } else if (strcmp(name, "devicePropertyDescriptions") == 0) {
-    
-    } else if (strcmp(name, "customActions") == 0) {
-
-    } else if (strcmp(name, "binaryInputDescriptions") == 0) {      
-        dsvdc_property_t *reply;
-        ret = dsvdc_property_new(&reply);
-        if (ret != DSVDC_OK) {
-          vdc_report(LOG_ERR, "failed to allocate reply property for %s\n", name);
-          free(name);
-          continue;
-        }
-
-        int i = 0;
-        char sensorName[64];
-        char sensorIndex[64];
-        
-        while (1) {
-          if (sauna_device->sauna->binary_values[i].is_active) {
-            vdc_report(LOG_ERR, "************* %d %s\n", i, sauna_device->sauna->binary_values[i].value_name);
-           
-            snprintf(sensorName, 64, "%s-%s", sauna_device->sauna->name, sauna_device->sauna->binary_values[i].value_name);
-          
-            dsvdc_property_t *nProp;
-            if (dsvdc_property_new(&nProp) != DSVDC_OK) {
-              vdc_report(LOG_ERR, "failed to allocate reply property for %s/%s\n", name, sensorName);
-              break;
-            }
-        
-            dsvdc_property_add_string(nProp, "name", sensorName);
-            dsvdc_property_add_uint(nProp, "inputType", 1);
-            dsvdc_property_add_uint(nProp, "inputUsage", 0);
-            dsvdc_property_add_uint(nProp, "sensorFunction", sauna_device->sauna->binary_values[i].sensor_function);
-            dsvdc_property_add_double(nProp, "updateInterval", 5);
-          
-            snprintf(sensorIndex, 64, "%d", i);
-            dsvdc_property_add_property(reply, sensorIndex, &nProp);
-
-            vdc_report(LOG_INFO, "binaryInputDescription: dsuid %s sensorIndex %s: %s function %d\n", dsuid, sensorIndex, sensorName, sauna_device->sauna->binary_values[i].sensor_function);
-            
-            i++;
-          } else {
-            break;
-          }
-        }
-        
-        dsvdc_property_add_property(property, name, &reply);
-        
-    } else if (strcmp(name, "binaryInputSettings") == 0) {      
-      dsvdc_property_t *reply;
-      ret = dsvdc_property_new(&reply);
-      if (ret != DSVDC_OK) {
-        vdc_report(LOG_ERR, "failed to allocate reply property for %s\n", name);
-        free(name);
-        continue;
-      }
-
-      char sensorIndex[64];
-      int i = 0;
-      while (1) {
-        if (sauna_device->sauna->binary_values[i].is_active) {
-          dsvdc_property_t *nProp;
-          if (dsvdc_property_new(&nProp) != DSVDC_OK) {
-            vdc_report(LOG_ERR, "failed to allocate reply property for %s\n", name);
-            break;
-          }
-          dsvdc_property_add_uint(nProp, "group", 8);
-          dsvdc_property_add_uint(nProp, "sensorFunction", sauna_device->sauna->binary_values[i].sensor_function);
-
-          snprintf(sensorIndex, 64, "%d", i);
-          dsvdc_property_add_property(reply, sensorIndex, &nProp);
-        
-          vdc_report(LOG_INFO, "binaryInputSettings: dsuid %s sensorIndex %s:  function %d\n", dsuid, sensorIndex, sauna_device->sauna->binary_values[i].sensor_function);
-          
-          i++;
-        } else {
-          break;
-        }
-      }
-      dsvdc_property_add_property(property, name, &reply);
-      
-    } else if (strcmp(name, "sensorDescriptions") == 0) {
-      dsvdc_property_t *reply;
-      ret = dsvdc_property_new(&reply);
-      if (ret != DSVDC_OK) {
-        vdc_report(LOG_ERR, "failed to allocate reply property for %s\n", name);
-        free(name);
-        continue;
-      }
-
-      int i = 0;
-      char sensorName[64];
-      char sensorIndex[64];
-	    
-      while(1) {
-        if (sauna_device->sauna->sensor_values[i].is_active) {
-          vdc_report(LOG_ERR, "************* %d %s\n", i, sauna_device->sauna->sensor_values[i].value_name);
-        
-          snprintf(sensorName, 64, "%s-%s", sauna_device->sauna->name, sauna_device->sauna->sensor_values[i].value_name);
-
-          dsvdc_property_t *nProp;
-          if (dsvdc_property_new(&nProp) != DSVDC_OK) {
-            vdc_report(LOG_ERR, "failed to allocate reply property for %s/%s\n", name, sensorName);
-            break;
-          }
-          dsvdc_property_add_string(nProp, "name", sensorName);
-          dsvdc_property_add_uint(nProp, "sensorType", sauna_device->sauna->sensor_values[i].sensor_type);
-          dsvdc_property_add_uint(nProp, "sensorUsage", sauna_device->sauna->sensor_values[i].sensor_usage);
-          dsvdc_property_add_double(nProp, "aliveSignInterval", 300);
-
-          snprintf(sensorIndex, 64, "%d", i);
-          dsvdc_property_add_property(reply, sensorIndex, &nProp);
-
-          vdc_report(LOG_INFO, "sensorDescription: dsuid %s sensorIndex %s: %s type %d usage %d\n", dsuid, sensorIndex, sensorName, sauna_device->sauna->sensor_values[i].sensor_type, sauna_device->sauna->sensor_values[i].sensor_usage); 
-          
-          i++;
-        } else {
-          break;
-        }
-      }
-
-		  dsvdc_property_add_property(property, name, &reply);  
-    } else if (strcmp(name, "sensorSettings") == 0) {
-      dsvdc_property_t *reply;
-      ret = dsvdc_property_new(&reply);
-      if (ret != DSVDC_OK) {
-        vdc_report(LOG_ERR, "failed to allocate reply property for %s\n", name);
-        free(name);
-        continue;
-      }
-
-      char sensorIndex[64];
-      int i = 0;
-      while (1) {
-        if (sauna_device->sauna->sensor_values[i].is_active) {
-          dsvdc_property_t *nProp;
-          if (dsvdc_property_new(&nProp) != DSVDC_OK) {
-            vdc_report(LOG_ERR, "failed to allocate reply property for %s\n", name);
-            break;
-          }
-          dsvdc_property_add_uint(nProp, "group", 8);
-          dsvdc_property_add_uint(nProp, "minPushInterval", 5);
-          dsvdc_property_add_double(nProp, "changesOnlyInterval", 5);
-
-          snprintf(sensorIndex, 64, "%d", i);
-          dsvdc_property_add_property(reply, sensorIndex, &nProp);
-          
-          i++;
-        } else {
-          break;
-        }
-      }
-      dsvdc_property_add_property(property, name, &reply); 
-      
-      vdc_report(LOG_INFO, "sensorSettings: dsuid %s sensorIndex %s\n", dsuid, sensorIndex); 
-
-    } else if (strcmp(name, "sensorStates") == 0) {
-      dsvdc_property_t *reply;
-      ret = dsvdc_property_new(&reply);
-      if (ret != DSVDC_OK) {
-        vdc_report(LOG_ERR, "failed to allocate reply property for %s\n", name);
-        free(name);
-        continue;
-      }
-
-      int idx;
-      char* sensorIndex;
-      dsvdc_property_t *sensorRequest;
-      dsvdc_property_get_property_by_index(query, 0, &sensorRequest);
-      if (dsvdc_property_get_name(sensorRequest, 0, &sensorIndex) != DSVDC_OK) {
-        vdc_report(LOG_DEBUG, "sensorStates: no index in request\n");
-        idx = -1;
-      } else {
-        idx = strtol(sensorIndex, NULL, 10);
-      }
-      dsvdc_property_free(sensorRequest);
-
-      time_t now = time(NULL);
-      
-      int i = 0;
-      while (1) {
-        if (sauna_device->sauna->sensor_values[i].is_active) {
-          if (idx >= 0 && idx != i) {
-            i++;
-            continue;
-          }
-
-          dsvdc_property_t *nProp;
-          if (dsvdc_property_new(&nProp) != DSVDC_OK) {
-            vdc_report(LOG_ERR, "failed to allocate reply property for %s\n", name);
-            break;
-          }
-
-          double val = sauna_device->sauna->sensor_values[i].value;
-
-          dsvdc_property_add_double(nProp, "value", val);
-          dsvdc_property_add_int(nProp, "age", now - sauna_device->sauna->sensor_values[i].last_query);
-          dsvdc_property_add_int(nProp, "error", 0);
-
-          char replyIndex[64];
-          snprintf(replyIndex, 64, "%d", i);
-          dsvdc_property_add_property(reply, replyIndex, &nProp);
-          
-          i++;
-        } else {
-          break;
-        }
-      }
-      dsvdc_property_add_property(property, name, &reply);  
-
-    } else if (strcmp(name, "binaryInputStates") == 0) {      
-      dsvdc_property_t *reply;
-      ret = dsvdc_property_new(&reply);
-      if (ret != DSVDC_OK) {
-        vdc_report(LOG_ERR, "failed to allocate reply property for %s\n", name);
-        free(name);
-        continue;
-      }
-
-      int idx;
-      char* sensorIndex;
-      dsvdc_property_t *sensorRequest;
-      dsvdc_property_get_property_by_index(query, 0, &sensorRequest);
-      if (dsvdc_property_get_name(sensorRequest, 0, &sensorIndex) != DSVDC_OK) {
-        vdc_report(LOG_DEBUG, "binaryInputStates: no index in request\n");
-        idx = -1;
-      } else {
-        idx = strtol(sensorIndex, NULL, 10);
-      }
-      dsvdc_property_free(sensorRequest);
-      
-      time_t now = time(NULL);
-
-      int i = 0;
-      while (1) {
-        if (sauna_device->sauna->binary_values[i].is_active) {
-          if (idx >= 0 && idx != i) {
-            i++;
-            continue;
-          }
-        
-          dsvdc_property_t *nProp;
-          if (dsvdc_property_new(&nProp) != DSVDC_OK) {
-            vdc_report(LOG_ERR, "failed to allocate reply property for %s\n", name);
-            break;
-          }
-        
-          dsvdc_property_add_bool(nProp, "value",  sauna_device->sauna->binary_values[i].value);
-          dsvdc_property_add_int(nProp, "age", now - sauna_device->sauna->binary_values[i].last_query);
-          dsvdc_property_add_int(nProp, "error", 0);
-
-          char replyIndex[64];
-          snprintf(replyIndex, 64, "%d", i);
-          dsvdc_property_add_property(reply, replyIndex, &nProp);
-          
-          i++;
-        } else {
-          break;
-        }
-      }    
-      dsvdc_property_add_property(property, name, &reply); 
-
-    } else if (strcmp(name, "name") == 0) {
-      dsvdc_property_add_string(property, name, sauna_device->sauna->name);
-
-    } else if (strcmp(name, "type") == 0) {
-      dsvdc_property_add_string(property, name, "vDSD");
-
-    } else if (strcmp(name, "model") == 0) {
-      char info[256];
-      strcpy(info, "Sauna");
-     
-      dsvdc_property_add_string(property, name, info);
-    } else if (strcmp(name, "modelFeatures") == 0) {
-      dsvdc_property_t *nProp;
-      dsvdc_property_new(&nProp);
-      dsvdc_property_add_bool(nProp, "dontcare", false);
-      dsvdc_property_add_bool(nProp, "blink", false);
-      dsvdc_property_add_bool(nProp, "outmode", false);
-      dsvdc_property_add_bool(nProp, "jokerconfig", true);
-      dsvdc_property_add_property(property, name, &nProp);
-    } else if (strcmp(name, "modelUID") == 0) {      
-      dsvdc_property_add_string(property, name, "Klafs Sauna");
-
-    } else if (strcmp(name, "modelVersion") == 0) {
-      dsvdc_property_add_string(property, name, "0");
-
-    } else if (strcmp(name, "deviceClass") == 0) {
-    } else if (strcmp(name, "deviceClassVersion") == 0) {
-    } else if (strcmp(name, "oemGuid") == 0) {
-    } else if (strcmp(name, "oemModelGuid") == 0) {
-
-    } else if (strcmp(name, "vendorId") == 0) {
-      dsvdc_property_add_string(property, name, "vendor: Klafs");
-
-    } else if (strcmp(name, "vendorName") == 0) {
-      dsvdc_property_add_string(property, name, "Klafs");
-
-    } else if (strcmp(name, "vendorGuid") == 0) {
-      char info[256];
-      strcpy(info, "Klafs vDC ");
-      strcat(info, sauna_device->sauna->id);
-      dsvdc_property_add_string(property, name, info);
-
-    } else if (strcmp(name, "hardwareVersion") == 0) {
-      dsvdc_property_add_string(property, name, "0.0.0");
-
-    } else if (strcmp(name, "configURL") == 0) {
-      dsvdc_property_add_string(property, name, "");
-
-    } else if (strcmp(name, "hardwareModelGuid") == 0) {
-      dsvdc_property_add_string(property, name, "");
-
-    } else if (strcmp(name, "deviceIcon16") == 0) {
-        dsvdc_property_add_bytes(property, name, gIconStation16Data, gIconStation16Size);
-
-    } else if (strcmp(name, "deviceIcon48") == 0) {
-        dsvdc_property_add_bytes(property, name, gIconStation48Data, gIconStation48Size);
-
-    } else if (strcmp(name, "deviceIconName") == 0) {
-      char info[256];
-      strcpy(info, "klafs-sauna-16.png");
-      
-      dsvdc_property_add_string(property, name, info);
-
+    const struct vdc_property_handler *handler = vdsd_property_lookup(name, strlen(name));
+    if (handler != NULL && handler->get != NULL) {
+      handler->get(property, query, i, name);
     } else {
       vdc_report(LOG_WARNING, "get property handler: unhandled name=\"%s\"\n", name);
     }
 
     free(name);
   }
+  identity_read_unlock();
 
-  pthread_mutex_unlock(&g_network_mutex);
   dsvdc_send_get_property_response(handle, property);
 }
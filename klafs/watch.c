@@ -0,0 +1,138 @@
+/*
+ Author: Alexander Knauer <a-x-e@gmx.net>
+ License: Apache 2.0
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <libgen.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#ifdef HAVE_SYS_INOTIFY_H
+#include <sys/inotify.h>
+#endif
+
+#include <digitalSTROM/dsuid.h>
+#include <dsvdc/dsvdc.h>
+
+#include "klafs.h"
+
+/* configuration hot reload: the directory of the configuration file is
+ * watched, since editors and write_config() replace the file by renaming;
+ * bursts of events are collected for WATCH_SETTLE_MS before reloading
+ */
+
+#define WATCH_POLL_MS 1000
+#define WATCH_SETTLE_MS 500
+
+#ifdef HAVE_SYS_INOTIFY_H
+
+static pthread_t g_watch_thread;
+static bool g_watch_running = false;
+static int g_watch_fd = -1;
+static char g_watch_name[NAME_MAX + 1];
+
+/* reads all pending events, returns true if one of them is about the configuration file */
+static bool watch_read_events() {
+  char buffer[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+  bool matched = false;
+
+  ssize_t length = read(g_watch_fd, buffer, sizeof(buffer));
+  for (char *p = buffer; length > 0 && p < buffer + length; ) {
+    struct inotify_event *event = (struct inotify_event *) p;
+    if (event->len > 0 && strcmp(event->name, g_watch_name) == 0) {
+      matched = true;
+    }
+    p += sizeof(struct inotify_event) + event->len;
+  }
+  return matched;
+}
+
+static void* watchThread(void *arg __attribute__((unused))) {
+  struct pollfd pfd = { .fd = g_watch_fd, .events = POLLIN };
+
+  while (!g_shutdown_flag) {
+    if (poll(&pfd, 1, WATCH_POLL_MS) <= 0 || !watch_read_events()) {
+      continue;
+    }
+
+    /* wait until the file is settled */
+    while (poll(&pfd, 1, WATCH_SETTLE_MS) > 0) {
+      watch_read_events();
+    }
+
+    if (config_is_own_write()) {
+      vdc_report(LOG_DEBUG, "watch: ignoring change of %s written by ourselves\n", g_cfgfile);
+      continue;
+    }
+
+    vdc_report(LOG_INFO, "watch: %s changed, reloading\n", g_cfgfile);
+    reload_config();
+  }
+
+  return NULL;
+}
+
+void config_watch_start() {
+  char path[PATH_MAX];
+
+  if (!g_watch_config) {
+    return;
+  }
+
+  strncpy(path, g_cfgfile, sizeof(path) - 1);
+  path[sizeof(path) - 1] = 0;
+  strncpy(g_watch_name, basename(path), sizeof(g_watch_name) - 1);
+  strncpy(path, g_cfgfile, sizeof(path) - 1);
+  path[sizeof(path) - 1] = 0;
+  const char *dir = dirname(path);
+
+  g_watch_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (g_watch_fd < 0) {
+    vdc_report(LOG_ERR, "watch: inotify initialization failed\n");
+    return;
+  }
+  if (inotify_add_watch(g_watch_fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+    vdc_report(LOG_ERR, "watch: cannot watch directory %s\n", dir);
+    close(g_watch_fd);
+    g_watch_fd = -1;
+    return;
+  }
+  if (pthread_create(&g_watch_thread, NULL, &watchThread, 0) != 0) {
+    vdc_report(LOG_ERR, "watch: thread initialization failed\n");
+    close(g_watch_fd);
+    g_watch_fd = -1;
+    return;
+  }
+  g_watch_running = true;
+  vdc_report(LOG_INFO, "watch: watching %s for changes\n", g_cfgfile);
+}
+
+void config_watch_stop() {
+  if (g_watch_running) {
+    pthread_join(g_watch_thread, NULL);
+    g_watch_running = false;
+  }
+  if (g_watch_fd >= 0) {
+    close(g_watch_fd);
+    g_watch_fd = -1;
+  }
+}
+
+#else
+
+void config_watch_start() {
+  if (g_watch_config) {
+    vdc_report(LOG_NOTICE, "watch: inotify is not available, configuration changes need a restart\n");
+  }
+}
+
+void config_watch_stop() {
+}
+
+#endif